@@ -0,0 +1,78 @@
+// File: boundary.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the preparation of the bounding polygon and its layer
+// of dummy boundary particles. Preparing them only depends on the polygon
+// and the particle spacing, so simulations that share a polygon can share
+// the result through a BoundaryCache. The cache also shares the boundary
+// particles once they are binned (see static_boundary.h), which further
+// depends on their range and on the search radius. Periodic axes have no walls, so the
+// polygon edges on the sides of the bounding box across them get no layer,
+// and neither do open edges with inflow or outflow (see flow_boundary.h).
+
+#pragma once
+
+#include "geometry.h"
+#include "grid.h"
+#include "particle.h"
+#include "static_boundary.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct PreparedBoundary
+{
+    Polygon domain;
+
+    // Bounding box of the polygon
+    double xmin, xmax, ymin, ymax;
+
+    // Dummy particles outside of the polygon, within thickness*spacing of
+    // an edge. Only their positions are set.
+    std::vector<SPHParticle> particles;
+};
+
+// Read the polygon from a text file of "x y" lines, or from a binary vertex
+// file (see loader.h), and generate the boundary particles on a lattice.
+// Along a periodic axis the lattice fits the period exactly.
+PreparedBoundary prepare_boundary(const std::string& polygon_file,
+                                  bool binary, double spacing,
+                                  double thickness, bool periodic_x = false,
+                                  bool periodic_y = false,
+                                  const std::vector<int>& open_edges = {});
+
+// Whether each edge of the polygon, from vertex i to vertex i+1, is a wall.
+// Edges along the sides of the box across a periodic axis are seams instead,
+// and open edges are not walls either.
+std::vector<bool> wall_edges(const Polygon& domain,
+                             const Periodicity& periodicity,
+                             const std::vector<int>& open_edges = {});
+
+// Bin the boundary particles of prepared, all with the given range, for
+// queries out to radius
+StaticBoundary build_walls(const PreparedBoundary& prepared,
+                           const Periodicity& periodicity, double range,
+                           double radius);
+
+// Thread safe store of prepared boundaries, keyed by their arguments, and
+// of their binned particles
+class BoundaryCache
+{
+public:
+    std::shared_ptr<const PreparedBoundary> get(
+        const std::string& polygon_file, bool binary, double spacing,
+        double thickness, bool periodic_x = false, bool periodic_y = false,
+        const std::vector<int>& open_edges = {});
+
+    // prepared has to come from get, whose key fixes the periodicity
+    std::shared_ptr<const StaticBoundary> walls(
+        const std::shared_ptr<const PreparedBoundary>& prepared,
+        const Periodicity& periodicity, double range, double radius);
+
+private:
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<const PreparedBoundary>> prepared;
+    std::map<std::string, std::shared_ptr<const StaticBoundary>> binned;
+};
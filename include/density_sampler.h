@@ -0,0 +1,72 @@
+// File: density_sampler.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the incremental density sampler. The sample grid is
+// split into square tiles, and the sampler keeps the field from the last
+// update. On each update only the tiles that a particle entered, left, or
+// moved inside of by more than the tolerance are recomputed, so a mostly
+// resting fluid is cheap to sample at a high rate. Along periodic axes a
+// particle near the seam also contributes through its images.
+
+#pragma once
+
+#include "grid.h"
+#include "particle.h"
+#include <vector>
+
+class DensitySampler
+{
+public:
+    DensitySampler() = default;
+
+    // Set the sample points to x = xmin + i*width/x_samples and
+    // y = ymin + j*height/y_samples. Changing them discards the stored field.
+    void resize(int x_samples, int y_samples,
+                double xmin, double ymin, double width, double height);
+
+    // Bring the field up to date with the particles, and return the number
+    // of tiles that were recomputed. Particles are matched to the last
+    // update by index.
+    int update(const std::vector<SPHParticle>& particles);
+
+    // Recompute everything on the next update, for when the particles have
+    // been renumbered and matching them by index would mark every tile
+    void reset() { stale = true; }
+
+    // Samples are stored with y varying fastest, at [i*y_samples + j]
+    const std::vector<double>& field() const { return samples; }
+
+    // Samples per tile side, and the distance a particle may move before
+    // its contribution is refreshed. A tolerance of 0 gives the same field
+    // as a full resample.
+    int tile_size = 32;
+    double tolerance = 0.;
+
+    // Periodic axes of the sampled rectangle
+    Periodicity periodicity;
+
+private:
+    // The particle state that the stored field was computed from
+    struct Footprint
+    {
+        double x, y, mass, range;
+    };
+
+    int x_samples = 0;
+    int y_samples = 0;
+    double xmin = 0., ymin = 0.;
+    double dx = 0., dy = 0.;
+    int tiles_x = 0;
+    int tiles_y = 0;
+
+    std::vector<double> samples;
+    std::vector<Footprint> previous;
+    std::vector<char> dirty;
+    bool stale = true;
+
+    // Call visit(tile) for each tile overlapped by the kernel support of
+    // any image of the footprint. A tile may be visited more than once.
+    template<typename Visit>
+    void for_each_tile(const Footprint& footprint, Visit visit) const;
+    void recompute_tile(int tile, const std::vector<unsigned int>& members);
+};
@@ -0,0 +1,58 @@
+// File: ensemble.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the ensemble driver, which runs many variations of one
+// input file in a single process. Each combination of the swept parameters
+// is a member with its own output directory. Members are run by a fixed set
+// of worker threads, which steal work from each other when they run out, and
+// they share prepared boundaries.
+//
+// The specification file has the same comment rules as input.txt:
+//     base input.txt          input file that members start from
+//     output ensemble         directory holding one directory per member
+//     workers 4               worker threads, default is hardware threads
+//     member_threads 1        OpenMP threads inside of each member
+//     sweep timestep 1e-3 5e-4
+//     sweep boundary_file boundary.txt wide.txt
+// Every sweep line lists the values of one parameter, and every combination
+// of them is run. Parameters that take several numbers have them joined by
+// commas, as in "sweep gravity 0,-9.81 0,-1".
+
+#pragma once
+
+#include "boundary.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+class Ensemble
+{
+public:
+    explicit Ensemble(const std::string& specification);
+
+    // Run every member, and return the number that failed
+    int run();
+
+private:
+    std::string base = "input.txt";
+    std::string output = "ensemble";
+    unsigned int workers = 0;
+    unsigned int member_threads = 1;
+
+    // Parameter name and its values, in the order given
+    std::vector<std::pair<std::string, std::vector<std::string>>> sweeps;
+
+    struct Member
+    {
+        std::string directory;
+        std::vector<std::pair<std::string, std::string>> parameters;
+        double cost;
+    };
+    std::vector<Member> members;
+
+    BoundaryCache boundary_cache;
+
+    void expand();
+    void write_input(const Member& member) const;
+    int run_member(const Member& member);
+};
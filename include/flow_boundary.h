@@ -0,0 +1,91 @@
+// File: flow_boundary.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines open boundaries on edges of the bounding polygon, so
+// that fluid can enter and leave the domain instead of the whole channel
+// having to be filled from the start. Edge i runs from vertex i to vertex
+// i+1. Open edges get no layer of boundary particles.
+//     inflow   particles enter through the edge with a fixed speed along
+//              its inward normal, one row every spacing of travel. They
+//              keep that velocity until they are a kernel range inside, so
+//              the fluid behind them can't push back out through the edge.
+//     outflow  particles that cross the edge are removed
+// Particles are inserted into and removed from a ParticleStore, which
+// recycles the slots of removed particles.
+
+#pragma once
+
+#include "geometry.h"
+#include "precision.h"
+#include <cstddef>
+#include <vector>
+
+struct Inflow
+{
+    int edge;
+    double speed;
+
+    // Distance between emitted particles, along and across the edge. Zero
+    // means the spacing of fluid at rest density with the mean mass.
+    double spacing = 0.;
+};
+
+class FlowBoundaries
+{
+public:
+    FlowBoundaries() = default;
+
+    std::vector<Inflow> inflows;
+    std::vector<int> outflows;
+
+    bool empty() const { return inflows.empty() && outflows.empty(); }
+
+    // Edges without a wall
+    std::vector<int> open_edges() const;
+
+    // Find the geometry of the open edges
+    void prepare(const Polygon& domain);
+
+    // Set the spacing, mass and range of the emitted particles from the
+    // fluid at rest density. Called after prepare().
+    void set_fluid(double rest_density, double mean_mass, double mean_range);
+
+    // Remove the particles that left through an outflow, and emit the rows
+    // of inflow particles that are due after dt. The slots of the emitted
+    // particles are appended to inserted. Returns the number removed.
+    template<typename Policy>
+    std::size_t exchange(ParticleStore<Policy>& store, double dt,
+                         std::vector<std::size_t>& inserted);
+
+    // Give the particles in the buffer of an inflow edge the inflow
+    // velocity, and no acceleration
+    template<typename Policy>
+    void impose(ParticleStore<Policy>& store,
+                std::vector<double>& acceleration_x,
+                std::vector<double>& acceleration_y) const;
+
+private:
+    struct Edge
+    {
+        double start_x, start_y;
+        double tangent_x, tangent_y;    // unit vector from start to end
+        double normal_x, normal_y;      // unit vector into the domain
+        double length;
+    };
+
+    // Distance of (x, y) inside of the edge, and along it from its start
+    static void locate(const Edge& edge, double x, double y,
+                       double& depth, double& along)
+    {
+        depth = (x - edge.start_x)*edge.normal_x
+                + (y - edge.start_y)*edge.normal_y;
+        along = (x - edge.start_x)*edge.tangent_x
+                + (y - edge.start_y)*edge.tangent_y;
+    }
+
+    std::vector<Edge> inflow_edges, outflow_edges;
+    std::vector<double> travelled;
+    std::vector<double> spacings;
+    std::vector<double> masses;
+    double range = 0.;
+};
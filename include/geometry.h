@@ -31,6 +31,10 @@ struct Polygon
 double distance_to_line_segment(const arma::vec& point,
                             const Line_Segment& segment);
 
+// The point of the segment that is closest to point
+arma::vec closest_point_on_line_segment(const arma::vec& point,
+                                        const Line_Segment& segment);
+
 // Use raycasting to determine whether a point is inside a polygon
 bool point_inside_polygon(const arma::vec& point, const Polygon& polygon);
 
@@ -0,0 +1,342 @@
+// File: grid.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// The grid structure for tracking neighbors.
+// On construction, calculate bounding box and determine cell size
+// from the particles, and then use a counting sort to sort the
+// particle indices by cell for increased cache hits and ease/speed of
+// access. Neighbors are found by visiting the cells around a point.
+// Periodic axes wrap the cell indices, and each neighbor is visited with
+// the shift that gives its nearest image, so no ghost copies are needed.
+
+#pragma once
+
+#include "particle.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Periodic axes of the box with lower left corner (xmin, ymin)
+struct Periodicity
+{
+    bool x = false;
+    bool y = false;
+    double xmin = 0.;
+    double ymin = 0.;
+    double length_x = 0.;
+    double length_y = 0.;
+
+    bool any() const { return x || y; }
+
+    // Map a coordinate back into the box along periodic axes. Rounding can
+    // land a coordinate just below the lower edge on the upper one, which
+    // belongs to the first period.
+    double wrap_x(double _x) const
+    {
+        if (!x)
+            return _x;
+        const double wrapped = _x - length_x*std::floor((_x-xmin)/length_x);
+        return wrapped < xmin + length_x ? wrapped : xmin;
+    }
+    double wrap_y(double _y) const
+    {
+        if (!y)
+            return _y;
+        const double wrapped = _y - length_y*std::floor((_y-ymin)/length_y);
+        return wrapped < ymin + length_y ? wrapped : ymin;
+    }
+
+    // Separation along each axis to the nearest image
+    double nearest_x(double separation) const
+    {
+        return x ? separation - length_x*std::round(separation/length_x)
+                 : separation;
+    }
+    double nearest_y(double separation) const
+    {
+        return y ? separation - length_y*std::round(separation/length_y)
+                 : separation;
+    }
+
+    // Find the shifts that move a disc of radius around (x, y) onto every
+    // part of the box it covers, starting with no shift. Returns the number
+    // of shifts, at most 9.
+    int images(double _x, double _y, double radius,
+               double shift_x[9], double shift_y[9]) const
+    {
+        double shifts_x[3] = {0.};
+        double shifts_y[3] = {0.};
+        int count_x = 1;
+        int count_y = 1;
+        if (x && _x - radius < xmin)
+            shifts_x[count_x++] = length_x;
+        if (x && _x + radius >= xmin + length_x)
+            shifts_x[count_x++] = -length_x;
+        if (y && _y - radius < ymin)
+            shifts_y[count_y++] = length_y;
+        if (y && _y + radius >= ymin + length_y)
+            shifts_y[count_y++] = -length_y;
+
+        int count = 0;
+        for (int i=0; i<count_x; i++)
+            for (int j=0; j<count_y; j++)
+            {
+                shift_x[count] = shifts_x[i];
+                shift_y[count] = shifts_y[j];
+                count++;
+            }
+        return count;
+    }
+};
+
+class Grid
+{
+public:
+    Grid() = default;
+
+    // Bin count particles, where position(n) returns an indexable pair of
+    // coordinates for particle n. Particles for which include(n) is false
+    // are left out, as if they didn't exist.
+    template<typename Position>
+    void build(std::size_t count, Position position, double _cell_size);
+    template<typename Position, typename Include>
+    void build(std::size_t count, Position position, double _cell_size,
+               Include include);
+    void build(const std::vector<SPHParticle>& particles, double _cell_size);
+
+    // Call visit(n) for every particle in the cells that overlap the square
+    // of half width radius around (x, y). The visited particles still need
+    // a distance check. Only for grids without periodic axes.
+    template<typename Visit>
+    void for_each_candidate(double x, double y, double radius,
+                            Visit visit) const;
+
+    // Call visit(n, shift_x, shift_y) for every particle image in the cells
+    // that overlap the square of half width radius around (x, y). The image
+    // is at the position of n plus the shift, which is zero unless an axis
+    // is periodic.
+    template<typename Visit>
+    void for_each_image(double x, double y, double radius,
+                        Visit visit) const;
+
+    // Periodic axes, set before build()
+    Periodicity periodicity;
+
+    // Requested cell size. Periodic axes stretch it so that a whole number
+    // of cells fits the period.
+    double cell_size = 0.;
+    double cell_size_x = 0.;
+    double cell_size_y = 0.;
+    double xmin = 0.;
+    double ymin = 0.;
+    int cells_x = 0;
+    int cells_y = 0;
+
+    // Particles in cell c are sorted[cell_start[c]] to
+    // sorted[cell_start[c+1]-1]. The sorted order is also a good order to
+    // store particles in for locality (index sort).
+    std::vector<unsigned int> cell_start;
+    std::vector<unsigned int> sorted;
+
+    int cell_x(double x) const
+    {
+        const int i = (int)std::floor((x-xmin)/cell_size_x);
+        if (periodicity.x)
+            return ((i % cells_x) + cells_x) % cells_x;
+        return std::min(cells_x-1, std::max(0, i));
+    }
+    int cell_y(double y) const
+    {
+        const int j = (int)std::floor((y-ymin)/cell_size_y);
+        if (periodicity.y)
+            return ((j % cells_y) + cells_y) % cells_y;
+        return std::min(cells_y-1, std::max(0, j));
+    }
+
+private:
+    std::vector<unsigned int> cell_of;
+};
+
+template<typename Position>
+void Grid::build(std::size_t count, Position position, double _cell_size)
+{
+    build(count, position, _cell_size, [](std::size_t) { return true; });
+}
+
+template<typename Position, typename Include>
+void Grid::build(std::size_t count, Position position, double _cell_size,
+                 Include include)
+{
+    cell_size = _cell_size;
+
+    // Determine the bounding box
+    double xmax = -DBL_MAX;
+    double ymax = -DBL_MAX;
+    xmin = DBL_MAX;
+    ymin = DBL_MAX;
+    std::size_t included = 0;
+    for (std::size_t n=0; n<count; n++)
+    {
+        if (!include(n))
+            continue;
+        included++;
+        const auto point = position(n);
+        xmin = std::min(xmin, (double)point[0]);
+        xmax = std::max(xmax, (double)point[0]);
+        ymin = std::min(ymin, (double)point[1]);
+        ymax = std::max(ymax, (double)point[1]);
+    }
+    if (included == 0)
+        xmin = xmax = ymin = ymax = 0.;
+
+    // Periodic axes always cover exactly one period
+    if (periodicity.x)
+    {
+        xmin = periodicity.xmin;
+        xmax = xmin + periodicity.length_x;
+    }
+    if (periodicity.y)
+    {
+        ymin = periodicity.ymin;
+        ymax = ymin + periodicity.length_y;
+    }
+
+    // Don't let a tiny cell size make more cells than are useful
+    const double area = (xmax-xmin+cell_size) * (ymax-ymin+cell_size);
+    const double max_cells = 4.*included + 16.;
+    if (area / (cell_size*cell_size) > max_cells)
+        cell_size = std::sqrt(area / max_cells);
+
+    if (periodicity.x)
+    {
+        cells_x = std::max(1, (int)(periodicity.length_x/cell_size));
+        cell_size_x = periodicity.length_x / cells_x;
+    }
+    else
+    {
+        cells_x = (int)((xmax-xmin)/cell_size) + 1;
+        cell_size_x = cell_size;
+    }
+    if (periodicity.y)
+    {
+        cells_y = std::max(1, (int)(periodicity.length_y/cell_size));
+        cell_size_y = periodicity.length_y / cells_y;
+    }
+    else
+    {
+        cells_y = (int)((ymax-ymin)/cell_size) + 1;
+        cell_size_y = cell_size;
+    }
+
+    // Counting sort by cell index, with left out particles past the end
+    const unsigned int cell_count = cells_x*cells_y;
+    cell_of.resize(count);
+    #pragma omp parallel for schedule(static)
+    for (long long n=0; n<(long long)count; n++)
+    {
+        if (!include(n))
+        {
+            cell_of[n] = cell_count;
+            continue;
+        }
+        const auto point = position(n);
+        cell_of[n] = cell_x(point[0])*cells_y + cell_y(point[1]);
+    }
+
+    cell_start.assign(cell_count + 2, 0);
+    for (std::size_t n=0; n<count; n++)
+        cell_start[cell_of[n]+1]++;
+    for (std::size_t c=1; c<cell_start.size(); c++)
+        cell_start[c] += cell_start[c-1];
+
+    sorted.resize(count);
+    std::vector<unsigned int> fill(cell_start.begin(), cell_start.end()-1);
+    for (std::size_t n=0; n<count; n++)
+        sorted[fill[cell_of[n]]++] = n;
+    sorted.resize(included);
+    cell_start.pop_back();
+}
+
+inline void Grid::build(const std::vector<SPHParticle>& particles,
+                        double _cell_size)
+{
+    build(particles.size(),
+          [&particles](std::size_t n) { return particles[n].position; },
+          _cell_size);
+}
+
+template<typename Visit>
+void Grid::for_each_candidate(double x, double y, double radius,
+                              Visit visit) const
+{
+    for_each_image(x, y, radius,
+                   [&visit](unsigned int n, double, double) { visit(n); });
+}
+
+template<typename Visit>
+void Grid::for_each_image(double x, double y, double radius,
+                          Visit visit) const
+{
+    if (sorted.empty())
+        return;
+
+    // Along periodic axes the range of cells is left unwrapped, and the
+    // number of whole periods it is off by gives the shift of the images
+    int i_start, i_end, j_start, j_end;
+    if (periodicity.x)
+    {
+        i_start = (int)std::floor((x-radius-xmin)/cell_size_x);
+        i_end = (int)std::floor((x+radius-xmin)/cell_size_x);
+    }
+    else
+    {
+        i_start = cell_x(x-radius);
+        i_end = cell_x(x+radius);
+    }
+    if (periodicity.y)
+    {
+        j_start = (int)std::floor((y-radius-ymin)/cell_size_y);
+        j_end = (int)std::floor((y+radius-ymin)/cell_size_y);
+    }
+    else
+    {
+        j_start = cell_y(y-radius);
+        j_end = cell_y(y+radius);
+    }
+
+    for (int i=i_start; i<=i_end; i++)
+    {
+        int column = i;
+        double shift_x = 0.;
+        if (periodicity.x)
+        {
+            const int periods = (int)std::floor((double)i / cells_x);
+            column = i - periods*cells_x;
+            shift_x = periods*periodicity.length_x;
+        }
+
+        if (!periodicity.y)
+        {
+            // Cells in a column are contiguous, so the whole column range
+            // is one run of the sorted list
+            const unsigned int first = cell_start[column*cells_y + j_start];
+            const unsigned int last = cell_start[column*cells_y + j_end + 1];
+            for (unsigned int k=first; k<last; k++)
+                visit(sorted[k], shift_x, 0.);
+            continue;
+        }
+
+        for (int j=j_start; j<=j_end; j++)
+        {
+            const int periods = (int)std::floor((double)j / cells_y);
+            const int row = j - periods*cells_y;
+            const double shift_y = periods*periodicity.length_y;
+            const unsigned int first = cell_start[column*cells_y + row];
+            const unsigned int last = cell_start[column*cells_y + row + 1];
+            for (unsigned int k=first; k<last; k++)
+                visit(sorted[k], shift_x, shift_y);
+        }
+    }
+}
@@ -0,0 +1,343 @@
+// File: integrator.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the kick-drift-kick leapfrog time integration.
+// The neighbor data is read as few times as possible each step:
+//     1. drift, and rebin the particles
+//     2. one sweep for density, with the pressure from the equation of state
+//        computed as soon as a particle's density is complete
+//     3. one sweep for the pressure force, with the closing half kick of
+//        this step and the opening half kick of the next step fused into it
+// The separations and kernel gradients found in the density sweep can be
+// cached, so the force sweep doesn't search the grid or take square roots.
+// Along periodic axes the particles are wrapped back into the box after the
+// drift, and neighbors across the seam are found through the grid's images.
+// Only the fluid is rebinned each step. The walls are a StaticBoundary, which
+// is only searched for fluid particles close to it. Particles enter and
+// leave through open edges just before the rebin, so the grid and the pair
+// cache only ever see live particles. Every compact_interval steps the
+// gaps they leave are closed up, in grid cell order.
+//
+// The grid cell size, a skin that lets the grid go several steps without a
+// rebin, how often the store is reordered into grid order, and the OpenMP
+// chunk size of the neighbor sweeps are set by tuning, which the Tuner can
+// pick by timing the steps as they run (see tuner.h).
+//
+// Instead of the stiff equation of state, the pressure can be solved for
+// implicitly with IISPH (Ihmsen et al. 2014), which holds the fluid at rest
+// density for timesteps set by the flow speed rather than the sound speed.
+// Each step is then a symplectic Euler step:
+//     1. rebin, and one sweep for density
+//     2. velocities from the forces other than pressure, and the diagonal of
+//        the pressure system
+//     3. relaxed Jacobi iterations for the pressure, starting from half of
+//        the last step's pressure, until the mean density error is below the
+//        tolerance
+//     4. kick with the pressure force, and drift
+// The system is never assembled. Every iteration is two sweeps over the
+// neighbor pairs, so the pair cache matters even more than for the default
+// solver.
+
+#pragma once
+
+#include "flow_boundary.h"
+#include "grid.h"
+#include "particle.h"
+#include "precision.h"
+#include "static_boundary.h"
+#include "tuner.h"
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Tait equation of state, with the constants for water from sketch.py
+struct EquationOfState
+{
+    double bulk_modulus = 2.15e9;           // K_0, Pa
+    double bulk_modulus_derivative = 7.15;  // K_0'
+    double rest_density = 1000.;            // kg/m^3
+    double background_pressure = 101325.;   // Pa
+
+    double pressure(double density) const;
+    double sound_speed() const;
+
+    // Work done compressing a unit mass from the rest density, the integral
+    // of P/rho^2 over the density, with the background pressure included
+    // since the pressure forces include it
+    double internal_energy(double density) const;
+};
+
+// Energy and momentum of the fluid, for checking conservation. The potential
+// energy is that of the gravity field, and the internal energy that stored
+// in the equation of state by compression. Under IISPH the pressure isn't
+// taken from the equation of state, so the internal energy is only a guide.
+struct Observables
+{
+    double kinetic_energy = 0.;
+    double potential_energy = 0.;
+    double internal_energy = 0.;
+    double momentum_x = 0.;
+    double momentum_y = 0.;
+};
+
+// How the pressure is found from the particles
+enum class PressureSolver { equation_of_state, iisph };
+
+PressureSolver parse_pressure_solver(const std::string& name);
+
+template<typename Policy>
+class Integrator
+{
+public:
+    using real = typename Policy::real;
+
+    Integrator() = default;
+
+    // Copy the particles in and compute the initial forces. Boundary
+    // particles take part in the sums, but never move, and walls must
+    // outlive the integrator. A rest density of zero is replaced by the
+    // mean initial density.
+    void initialize(const std::vector<SPHParticle>& particles,
+                    const StaticBoundary& walls,
+                    double xmin, double ymin);
+
+    // Advance by dt. Velocities are only brought to the full step when
+    // synchronize is set, which is needed before output. Otherwise the
+    // next step's opening half kick is already applied.
+    void step(double dt, bool synchronize);
+
+    // Copy positions, velocities and pressures out. Only meaningful after
+    // initialize() or a synchronized step.
+    void store(std::vector<SPHParticle>& particles) const;
+
+    // Mean density of the fluid particles from the last density sweep
+    double mean_density() const;
+
+    // Energy and momentum of the fluid particles. Only meaningful after
+    // initialize() or a synchronized step.
+    Observables observables() const;
+
+    std::size_t live() const { return fluid.live(); }
+
+    // Read access between steps, for queries such as probes that shouldn't
+    // copy the particles out or rebin them
+    const ParticleStore<Policy>& particles() const { return fluid; }
+    const StaticBoundary& boundary() const { return *walls; }
+    const Grid& neighbor_grid() const { return grid; }
+
+    // Velocity of fluid particle i at the full step. Between unsynchronized
+    // steps the stored velocity already has the next opening half kick.
+    std::array<double,2> velocity(std::size_t i) const
+    {
+        const double back = synchronized ? 0. : 0.5*last_dt;
+        const std::array<double,2> stored = fluid.velocity(i);
+        return {stored[0] - back*acceleration_x[i],
+                stored[1] - back*acceleration_y[i]};
+    }
+
+    // Call visit(j, separation_x, separation_y, distance, range) for every
+    // particle j (boundary particles come after the fluid) whose own range
+    // reaches the point (x, y). Works on the grid as it was last binned.
+    template<typename Visit>
+    void for_each_point_neighbor(double x, double y, Visit visit) const;
+
+    // Neighbor pairs in the last density sweep, each particle with itself
+    // included
+    std::size_t pairs = 0;
+
+    EquationOfState eos;
+    double gravity_x = 0.;
+    double gravity_y = -9.81;
+
+    // Monaghan artificial viscosity coefficient
+    double viscosity = 0.1;
+
+    // Keep separations and kernel gradients from the density sweep for the
+    // force sweep
+    bool cache_pairs = true;
+
+    // Periodic axes of the box, set before initialize()
+    Periodicity periodicity;
+
+    // Inflow and outflow edges, prepared before initialize(), and the
+    // steps between compactions of the particle store (0 never compacts)
+    FlowBoundaries flow;
+    unsigned int compact_interval = 100;
+
+    // Inserted particles are searched directly until the next rebin, and
+    // the grid is rebuilt early once there are more than this many of them
+    unsigned int max_unbinned = 64;
+
+    // Particles removed and inserted in the last step, and the number of
+    // times the store has been compacted or reordered, which changes the
+    // index of every particle
+    std::size_t removed = 0;
+    std::size_t inserted = 0;
+    unsigned long long renumberings = 0;
+
+    // Performance parameters. With auto_tune, the tuner starts from them in
+    // initialize() and changes them as it times the steps, and tuned is set
+    // by the step that settles them.
+    Tuning tuning;
+    bool auto_tune = false;
+    Tuner tuner;
+    bool tuned = false;
+
+    // Implicit pressure solver settings. The tolerance is on the mean
+    // density error relative to the rest density. The artificial viscosity
+    // still scales with the sound speed of the equation of state, so it
+    // usually needs to be lowered for iisph.
+    PressureSolver solver = PressureSolver::equation_of_state;
+    double solver_tolerance = 1e-3;
+    int solver_max_iterations = 100;
+    double solver_relaxation = 0.5;
+
+    // Iterations and relative density error of the last implicit solve
+    int solver_iterations = 0;
+    double solver_error = 0.;
+
+private:
+    struct Pair
+    {
+        unsigned int j;
+        real separation_x, separation_y;
+        real gradient;  // dW/dr / r, so the gradient is this times separation
+    };
+
+    ParticleStore<Policy> fluid;
+    const StaticBoundary* walls = nullptr;
+    std::vector<double> boundary_mass;
+
+    // Accelerations, and the velocity buffer that the force sweep writes,
+    // since neighbors still need the old velocities for viscosity
+    std::vector<double> acceleration_x, acceleration_y;
+    std::vector<double> next_vx, next_vy;
+
+    Grid grid;
+    double max_range = 0.;
+    bool synchronized = true;
+    double last_dt = 0.;
+    unsigned long long steps = 0;
+    std::vector<std::size_t> inserted_slots;
+
+    // The tuning the grid was binned with, how far any particle may have
+    // moved since, and whether one was wrapped across a periodic seam. The
+    // grid is good until the distance passes the skin.
+    Tuning binned;
+    double travel = 0.;
+    bool wrapped = false;
+    unsigned int since_sort = 0;
+
+    // Removed particles stay in the grid until the next rebin, and are
+    // skipped as free slots. Particles inserted since go in unbinned, which
+    // the searches visit directly, and are flagged so that the grid entry
+    // a reused slot may still have in its old cell is skipped. exchanged is
+    // set once either has happened, so the searches only check then.
+    std::vector<unsigned int> unbinned;
+    std::vector<char> is_unbinned;
+    bool exchanged = false;
+
+    // Per particle terms of the implicit pressure system: the change of
+    // velocity of i per unit of its own pressure (d_ii), the diagonal
+    // (a_ii), the density after the kick without pressure, and the velocity
+    // change from the pressure of the neighbors (sum over j of d_ij p_j)
+    std::vector<double> displacement_x, displacement_y, diagonal;
+    std::vector<double> advected_density, neighbor_x, neighbor_y;
+    std::vector<double> next_pressure;
+
+    // Pair cache, with one buffer per thread so that the density sweep
+    // never synchronizes. Pairs of particle i are
+    // pair_buffers[pair_owner[i]][pair_begin[i]] up to pair_end[i].
+    std::vector<std::vector<Pair>> pair_buffers;
+    std::vector<unsigned int> pair_owner;
+    std::vector<std::size_t> pair_begin, pair_end;
+
+    void advance(double dt, bool synchronize);
+    void rebuild_grid();
+    void resize_work_arrays();
+
+    // Radius of the grid search, the largest range and the skin
+    double search_radius() const { return max_range*(1.+tuning.skin); }
+
+    // Put the live particles in grid order, closing up free slots
+    void reorder();
+
+    // Record the largest speed and any wrap of the last drift
+    void moved(double dt, double max_speed, bool _wrapped);
+
+    // Exchange particles through the open edges, compact or reorder the
+    // store when it is due, and rebin when the grid is out of date
+    void update_particles(double dt);
+    void density_sweep();
+    void force_sweep(double kick);
+    void implicit_step(double dt);
+    void implicit_setup(double dt);
+    double implicit_iteration(double dt);
+
+    // Monaghan viscosity term between i and j, without the mass and kernel
+    // gradient, for the given approach velocity (dv . dr)
+    double artificial_viscosity(double approach, double distance_squared,
+                                double range, double mean_density) const;
+
+    // Call visit(j, separation_x, separation_y, distance, range) for every
+    // particle j (boundary particles come after the fluid) within the
+    // symmetrized range of fluid particle i, including i itself
+    template<typename Visit>
+    void for_each_neighbor(std::size_t i, Visit visit) const;
+
+    // Call visit(j, separation_x, separation_y, gradient) for every neighbor
+    // j other than i itself, where the kernel gradient is gradient times the
+    // separation. Reads the pair cache when it is enabled.
+    template<typename Visit>
+    void for_each_pair(std::size_t i, Visit visit) const;
+};
+
+template<typename Policy>
+template<typename Visit>
+void Integrator<Policy>::for_each_point_neighbor(double x, double y,
+                                                 Visit visit) const
+{
+    const std::size_t count = fluid.size();
+
+    // Particles may have drifted by up to travel since they were binned,
+    // and across a seam, so the search covers the drift and separations are
+    // taken to the nearest image instead of the grid's shift
+    const auto check = [&](unsigned int j)
+    {
+        const std::array<double,2> point = fluid.position(j);
+        const double separation_x = periodicity.nearest_x(x - point[0]);
+        const double separation_y = periodicity.nearest_y(y - point[1]);
+        const double range = fluid.range[j];
+        const double distance_squared =
+            separation_x*separation_x + separation_y*separation_y;
+        if (distance_squared < range*range)
+            visit(j, separation_x, separation_y,
+                  std::sqrt(distance_squared), range);
+    };
+    grid.for_each_image(x, y, max_range + travel,
+        [&](unsigned int j, double, double)
+        {
+            if (fluid.active[j] && !is_unbinned[j])
+                check(j);
+        });
+    for (unsigned int j : unbinned)
+    {
+        if (fluid.active[j])
+            check(j);
+    }
+
+    if (!walls->near(x, y))
+        return;
+    walls->for_each_candidate(x, y,
+        [&](unsigned int b, double separation_x, double separation_y)
+        {
+            const double range = walls->range[b];
+            const double distance_squared =
+                separation_x*separation_x + separation_y*separation_y;
+            if (distance_squared < range*range)
+                visit(count + b, separation_x, separation_y,
+                      std::sqrt(distance_squared), range);
+        });
+}
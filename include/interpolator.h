@@ -0,0 +1,163 @@
+// File: interpolator.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines SPH interpolation of per particle fields at arbitrary
+// points. A field A sampled by the fluid particles is interpolated as
+//     A(x) = sum_j m_j/rho_j A_j W(x - x_j, h_j)
+// and its gradient with the gradient of the kernel. With Shepard
+// normalization the sum is divided by sum_j m_j/rho_j W(x - x_j, h_j), which
+// makes constant fields exact even where the particles are sparse, such as
+// near walls and free surfaces.
+//
+// Queries are made in batches against a running integrator, between steps.
+// They search its own grid and read its particle columns and the densities
+// of its last density sweep in place, so nothing is built or copied for
+// them. Each batch is sorted by grid cell, so that nearby queries are
+// evaluated together and share the cached particle data, and is then
+// evaluated in parallel. Probes are density, pressure and velocity, and are
+// cheap enough to take every step.
+
+#pragma once
+
+#include "integrator.h"
+#include "kernel.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+class Interpolator
+{
+public:
+    Interpolator() = default;
+
+    // Interpolate a field with components values per fluid slot at each
+    // point, where field(j, a) writes the values of slot j to a[0] up to
+    // a[components-1]. Values are written to values[q*components + c], and
+    // if gradients isn't null the gradient of component c is written to
+    // gradients[(q*components + c)*2 + axis].
+    template<typename Policy, typename Field>
+    void interpolate(const Integrator<Policy>& integrator, Field field,
+                     int components,
+                     const std::vector<std::array<double,2>>& points,
+                     std::vector<double>& values,
+                     std::vector<double>* gradients = nullptr) const;
+
+    // The kernel sum of the mass of the fluid and of the walls, which stand
+    // for fluid at the rest density, and its gradient. With Shepard
+    // normalization it is divided by the volume sum over both.
+    template<typename Policy>
+    void density(const Integrator<Policy>& integrator,
+                 const std::vector<std::array<double,2>>& points,
+                 std::vector<double>& values,
+                 std::vector<double>* gradients = nullptr) const;
+
+    // Density, pressure and the velocity at the full step at each point.
+    // values holds density, pressure, vx and vy for each point in turn.
+    template<typename Policy>
+    void probe(const Integrator<Policy>& integrator,
+               const std::vector<std::array<double,2>>& points,
+               std::vector<double>& values) const;
+
+    bool shepard = false;
+
+private:
+    // The order to evaluate the points in, sorted by grid cell
+    static std::vector<unsigned int> cell_order(
+        const Grid& grid, const std::vector<std::array<double,2>>& points);
+};
+
+template<typename Policy, typename Field>
+void Interpolator::interpolate(const Integrator<Policy>& integrator,
+                               Field field, int components,
+                               const std::vector<std::array<double,2>>& points,
+                               std::vector<double>& values,
+                               std::vector<double>* gradients) const
+{
+    if (components <= 0)
+        throw std::invalid_argument("field needs at least one component");
+
+    const ParticleStore<Policy>& fluid = integrator.particles();
+    const std::size_t fluid_count = fluid.size();
+    const std::size_t count = points.size();
+    values.assign(count*components, 0.);
+    if (gradients != nullptr)
+        gradients->assign(count*components*2, 0.);
+    const Grid& index = integrator.neighbor_grid();
+    if (index.cells_x == 0 || index.cells_y == 0)
+        return;
+    const std::vector<unsigned int> order = cell_order(index, points);
+
+    #pragma omp parallel
+    {
+        // Sums of V_j A_j W and its gradient, with the Shepard sums of
+        // V_j W and its gradient in the last component
+        std::vector<double> a(components);
+        std::vector<double> sum(components+1), sum_x(components+1),
+                            sum_y(components+1);
+
+        #pragma omp for schedule(static)
+        for (long long k=0; k<(long long)count; k++)
+        {
+            const unsigned int q = order[k];
+            std::fill(sum.begin(), sum.end(), 0.);
+            std::fill(sum_x.begin(), sum_x.end(), 0.);
+            std::fill(sum_y.begin(), sum_y.end(), 0.);
+
+            integrator.for_each_point_neighbor(points[q][0], points[q][1],
+                [&](unsigned int j, double separation_x, double separation_y,
+                    double distance, double h)
+                {
+                    if (j >= fluid_count || fluid.density[j] <= 0.)
+                        return;
+                    const double volume = fluid.mass[j]/fluid.density[j];
+                    const double w = volume*cubic_sph_kernel_2d(distance/h)
+                                     /(h*h);
+                    double dw = 0.;
+                    if (distance > 0.)
+                        dw = volume*derivative_cubic_sph_kernel_2d(distance/h)
+                             /(h*h*h*distance);
+
+                    field(j, a.data());
+                    for (int c=0; c<=components; c++)
+                    {
+                        const double value = (c < components) ? a[c] : 1.;
+                        sum[c] += value*w;
+                        sum_x[c] += value*dw*separation_x;
+                        sum_y[c] += value*dw*separation_y;
+                    }
+                });
+
+            const double normal = sum[components];
+            for (int c=0; c<components; c++)
+            {
+                double value = sum[c];
+                double gradient_x = sum_x[c];
+                double gradient_y = sum_y[c];
+                if (shepard)
+                {
+                    // Quotient rule for the normalized sum
+                    if (normal > 0.)
+                    {
+                        value = sum[c]/normal;
+                        gradient_x = (sum_x[c] - value*sum_x[components])
+                                     /normal;
+                        gradient_y = (sum_y[c] - value*sum_y[components])
+                                     /normal;
+                    }
+                    else
+                        value = gradient_x = gradient_y = 0.;
+                }
+
+                values[q*components + c] = value;
+                if (gradients != nullptr)
+                {
+                    (*gradients)[(q*components + c)*2] = gradient_x;
+                    (*gradients)[(q*components + c)*2 + 1] = gradient_y;
+                }
+            }
+        }
+    }
+}
@@ -17,8 +17,10 @@
 // Only needed for interpolating values, including density initialization
 
 // q is the scaled distance, such that q=1 is the range of influence
-// This kernel is normalized for 2 dimensional simulation
+// This kernel is normalized for 2 dimensional simulation with unit range,
+// so the kernel for range h is cubic_sph_kernel_2d(r/h) / h^2
 double cubic_sph_kernel_2d(double q);
+double derivative_cubic_sph_kernel_2d(double q);
 arma::vec gradient_cubic_sph_kernel_2d(double q, arma::vec q_hat);
 
 
@@ -0,0 +1,69 @@
+// File: loader.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the binary initial condition loader. Large initial
+// conditions are generated outside of the simulation, so instead of going
+// through the text tokenizer they are memory mapped and copied straight
+// into the particle list.
+//
+// Particle file layout (native endianness):
+//     char     magic[4]    "SPHP"
+//     uint32   version     1
+//     uint64   count
+//     double   x[count], y[count], vx[count], vy[count],
+//              mass[count], range[count]
+//
+// Vertex file layout:
+//     char     magic[4]    "SPHV"
+//     uint32   version     1
+//     uint64   count
+//     double   xy[2*count] (x0, y0, x1, y1, ...)
+//
+// python/write_initial_conditions.py writes both formats.
+
+#pragma once
+
+#include "geometry.h"
+#include "grid.h"
+#include "particle.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct BinaryHeader
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t count;
+};
+
+// Read only view of a whole file. The mapping is released on destruction,
+// so pointers into data() must not outlive the object.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return bytes; }
+    std::size_t size() const { return length; }
+
+private:
+    int fd = -1;
+    const unsigned char* bytes = nullptr;
+    std::size_t length = 0;
+};
+
+// Load and validate a polygon written in the vertex file format
+Polygon load_vertices(const std::string& path);
+
+// Load and validate particles written in the particle file format.
+// Positions are first wrapped into the box along periodic axes, and then
+// every particle must lie inside of domain.
+void load_particles(const std::string& path, const Polygon& domain,
+                    std::vector<SPHParticle>& particles,
+                    const Periodicity& periodicity = Periodicity());
@@ -0,0 +1,83 @@
+// File: metrics.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the live metrics channel, a ring of records in a POSIX
+// shared memory segment that a monitor can attach to while the simulation
+// runs. The simulation is the only writer and never waits for a reader. Each
+// record is guarded by a sequence number, which is odd while the record is
+// being written, so a reader that raced the writer sees the sequence change
+// and drops or retries the record. Once the ring is full the oldest record
+// is overwritten.
+//
+// Segment layout (native endianness, 8 byte aligned):
+//     char     magic[4]    "SPHM"
+//     uint32   version     2
+//     uint32   capacity    records in the ring
+//     uint32   record_size bytes per record, 104
+//     uint64   head        records published so far
+//     uint32   state       1 while running, 2 once finished
+//     uint32   pid         of the writer
+//     uint8    reserved[32]
+// followed by capacity records, record n at slot n % capacity:
+//     uint64   sequence    2n+1 while being written, 2n+2 once complete
+//     uint64   step, particles
+//     double   time, dt, steps_per_second, pairs_per_second
+//     double   kinetic_energy, potential_energy, internal_energy
+//     double   momentum_x, momentum_y
+//     uint64   resident_bytes
+//
+// python/read_metrics.py attaches to a segment and prints or follows it.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct Metrics
+{
+    std::uint64_t step = 0;
+    std::uint64_t particles = 0;
+    double time = 0.;
+    double dt = 0.;
+    double steps_per_second = 0.;
+    double pairs_per_second = 0.;
+    double kinetic_energy = 0.;
+    double potential_energy = 0.;
+    double internal_energy = 0.;
+    double momentum_x = 0.;
+    double momentum_y = 0.;
+    std::uint64_t resident_bytes = 0;
+};
+
+class MetricsRing
+{
+public:
+    MetricsRing() = default;
+    ~MetricsRing();
+    MetricsRing(const MetricsRing&) = delete;
+    MetricsRing& operator=(const MetricsRing&) = delete;
+
+    // Create the segment, or take over a stale one of the same name, with
+    // room for capacity records. The name gets a leading / if it has none.
+    // Throws if a segment of that name is still being written by a running
+    // process.
+    void open(const std::string& _name, unsigned int capacity = 1024);
+
+    bool is_open() const { return segment != nullptr; }
+
+    // Write a record, overwriting the oldest once the ring is full
+    void publish(const Metrics& metrics);
+
+    // Mark the ring finished, unmap it and remove the name. Readers that
+    // are attached can still read the last records.
+    void close();
+
+    // Resident memory of this process, or 0 where it can't be read
+    static std::uint64_t resident_bytes();
+
+private:
+    void* segment = nullptr;
+    std::size_t size = 0;
+    std::string name;
+};
@@ -0,0 +1,237 @@
+// File: precision.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the precision policies for particle storage. The
+// neighbor loops are limited by memory bandwidth, so position, velocity,
+// mass and range can be stored in single precision, or as single precision
+// offsets from the corner of an anchor cell. Sums such as density and
+// force are always done in double precision. The time integration works on
+// double precision copies of position and velocity, from which the reduced
+// inputs are derived after every kick and drift, so increments smaller than
+// a float ulp of the position still accumulate.
+
+#pragma once
+
+#include "grid.h"
+#include "particle.h"
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+enum class Precision { double_precision, single_precision, cell_relative };
+
+Precision parse_precision(const std::string& name);
+std::string precision_name(Precision precision);
+
+// Everything in double, the reference path
+struct DoublePolicy
+{
+    using real = double;
+    static const bool cell_relative = false;
+};
+
+// Everything in float, absolute positions
+struct SinglePolicy
+{
+    using real = float;
+    static const bool cell_relative = false;
+};
+
+// Float offsets from the corner of the anchor cell holding the particle.
+// The offsets are small, so they keep nearly full float precision no matter
+// how far the particle is from the origin.
+struct CellRelativePolicy
+{
+    using real = float;
+    static const bool cell_relative = true;
+};
+
+// Structure of arrays particle storage. The per particle inputs are stored
+// with Policy::real, and the sums with double. When Policy::real isn't
+// double, position and velocity are also kept in double, which is what
+// position(), velocity() and the setters work on. Particles can be removed and
+// inserted while running. Removed particles leave a free slot, which is
+// reused by the next insertion, and compact() closes up the remaining gaps.
+template<typename Policy>
+class ParticleStore
+{
+public:
+    using real = typename Policy::real;
+
+    // Whether the neighbor loop inputs are reduced copies of double
+    // precision position and velocity
+    static const bool reduced = !std::is_same<real, double>::value
+                                || Policy::cell_relative;
+
+    ParticleStore() = default;
+
+    // Copy the particles in. Cell relative positions are measured from the
+    // anchor lattice with corner (xmin, ymin) and spacing anchor_size.
+    void load(const std::vector<SPHParticle>& particles,
+              double _xmin, double _ymin, double _anchor_size);
+
+    // Copy positions, velocities and pressures back out, one particle per
+    // slot, so that a particle keeps its index until the next compact().
+    // Free slots come out at rest and without mass, which makes them add
+    // nothing to any kernel sum.
+    void store(std::vector<SPHParticle>& particles) const;
+
+    // Slots, including free ones, and live particles
+    std::size_t size() const { return mass.size(); }
+    std::size_t live() const { return size() - free_slots.size(); }
+
+    // Take a free slot, or add one at the end, and return it. Density and
+    // pressure start at zero.
+    std::size_t insert(double _x, double _y, double _vx, double _vy,
+                       double _mass, double _range);
+    void remove(std::size_t n);
+
+    // Keep only the live particles, in the given order of their slots. The
+    // new slot of a particle is its position in order.
+    void compact(const std::vector<unsigned int>& order);
+
+    std::array<double,2> position(std::size_t n) const
+    {
+        if constexpr (reduced)
+            return {exact_x[n], exact_y[n]};
+        else
+            return {x[n], y[n]};
+    }
+
+    // Position as the neighbor loops see it, rounded to the inputs
+    std::array<double,2> input_position(std::size_t n) const
+    {
+        if constexpr (Policy::cell_relative)
+            return {xmin + anchor_x[n]*anchor_size + (double)x[n],
+                    ymin + anchor_y[n]*anchor_size + (double)y[n]};
+        else
+            return {(double)x[n], (double)y[n]};
+    }
+
+    std::array<double,2> velocity(std::size_t n) const
+    {
+        if constexpr (reduced)
+            return {exact_vx[n], exact_vy[n]};
+        else
+            return {vx[n], vy[n]};
+    }
+
+    void set_position(std::size_t n, double _x, double _y)
+    {
+        if constexpr (reduced)
+        {
+            exact_x[n] = _x;
+            exact_y[n] = _y;
+        }
+        if constexpr (Policy::cell_relative)
+        {
+            anchor_x[n] = (std::int32_t)std::floor((_x-xmin)/anchor_size);
+            anchor_y[n] = (std::int32_t)std::floor((_y-ymin)/anchor_size);
+            x[n] = _x - (xmin + anchor_x[n]*anchor_size);
+            y[n] = _y - (ymin + anchor_y[n]*anchor_size);
+        }
+        else
+        {
+            x[n] = _x;
+            y[n] = _y;
+        }
+    }
+
+    void set_velocity(std::size_t n, double _vx, double _vy)
+    {
+        if constexpr (reduced)
+        {
+            exact_vx[n] = _vx;
+            exact_vy[n] = _vy;
+        }
+        vx[n] = _vx;
+        vy[n] = _vy;
+    }
+
+    // Take the velocities of every slot from next_vx and next_vy, which get
+    // the old ones back. The sweeps write the new velocities there while
+    // other threads still read the old ones.
+    void swap_velocities(std::vector<double>& next_vx,
+                         std::vector<double>& next_vy);
+
+    // Separation of particle i from particle j. For cell relative storage
+    // the whole cells and offsets are subtracted separately, which keeps
+    // the precision of the offsets.
+    std::array<double,2> separation(std::size_t i, std::size_t j) const
+    {
+        if constexpr (Policy::cell_relative)
+            return {(anchor_x[i]-anchor_x[j])*anchor_size
+                        + ((double)x[i]-(double)x[j]),
+                    (anchor_y[i]-anchor_y[j])*anchor_size
+                        + ((double)y[i]-(double)y[j])};
+        else
+            return {(double)x[i]-(double)x[j], (double)y[i]-(double)y[j]};
+    }
+
+    double max_range() const;
+
+    // Bytes of per particle input, which is what the neighbor loops stream
+    static std::size_t bytes_per_particle()
+    {
+        return 6*sizeof(real)
+               + (Policy::cell_relative ? 2*sizeof(std::int32_t) : 0);
+    }
+
+    std::vector<real> x, y;
+    std::vector<std::int32_t> anchor_x, anchor_y;
+    std::vector<real> vx, vy, mass, range;
+
+    // Double precision position and velocity, only kept when reduced
+    std::vector<double> exact_x, exact_y, exact_vx, exact_vy;
+
+    std::vector<double> density;
+    std::vector<double> pressure;
+
+    // Whether each slot holds a particle
+    std::vector<char> active;
+
+private:
+    std::vector<unsigned int> free_slots;
+
+    double xmin = 0.;
+    double ymin = 0.;
+    double anchor_size = 1.;
+};
+
+// Kernel sum density at every particle, accumulated in double.
+// grid must have been built from the positions in store.
+template<typename Policy>
+void compute_density(ParticleStore<Policy>& store, const Grid& grid);
+
+// Error of a reduced precision path against the all double path. The
+// position and velocity errors are the rounding of the inputs, and the
+// trajectory errors the largest distance from the double precision run.
+struct PrecisionError
+{
+    double position_max;
+    double velocity_max;
+    double density_max;     // relative
+    double density_rms;     // relative
+    double trajectory_position_max;
+    double trajectory_velocity_max;
+    std::size_t bytes_per_particle;
+};
+
+// Input rounding and density error of one precision for the particles
+PrecisionError compare_precision(const std::vector<SPHParticle>& particles,
+                                 Precision precision, double xmin,
+                                 double ymin, double anchor_size);
+
+// Print the error of every reduced precision path to os. trajectories holds the
+// particles after the same steps from particles with double, float and cell
+// relative storage, in the order of Precision. Particles are matched by
+// slot, and slots that are free in either run are skipped.
+void report_precision(
+    const std::vector<SPHParticle>& particles,
+    const std::array<std::vector<SPHParticle>,3>& trajectories,
+    unsigned int steps, double xmin, double ymin, double anchor_size,
+    std::ostream& os);
@@ -0,0 +1,72 @@
+// File: quadtree.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines adaptive sampling of the density field. Instead of a
+// uniform grid, a quadtree is refined only where the field varies across a
+// node or where particles are crowded, down to a maximum depth. The variation
+// is taken over the corners and center of a node and the particles inside
+// it, so features smaller than the node are still found.
+//
+// Output file layout (native endianness):
+//     char     magic[4]    "SPHQ"
+//     uint32   version     1
+//     uint64   node_count
+//     double   xmin, ymin, width, height
+//     uint32   max_depth, reserved
+//     uint8    split[node_count]       preorder, 1 for nodes with children
+//     float    corners[4*leaf_count]   preorder leaves, lower left, lower
+//                                      right, upper left, upper right
+//
+// Children are ordered lower left, lower right, upper left, upper right.
+// python/resample_quadtree.py resamples the tree onto a uniform grid.
+
+#pragma once
+
+#include "grid.h"
+#include "particle.h"
+#include <string>
+#include <vector>
+
+class Quadtree
+{
+public:
+    Quadtree() = default;
+
+    // Refine the tree over the rectangle with lower left corner (xmin, ymin).
+    // grid must have been built from particles.
+    void build(const std::vector<SPHParticle>& particles, const Grid& grid,
+               double xmin, double ymin, double width, double height);
+
+    void write(const std::string& name) const;
+
+    // Bilinear interpolation of the leaf holding (x, y), as done by
+    // python/resample_quadtree.py, or 0 outside of the tree
+    double sample(double x, double y) const;
+
+    std::size_t node_count() const { return nodes.size(); }
+    std::size_t leaf_count() const;
+
+    int max_depth = 10;
+
+    // A node is split when the field varies across it, or between it and
+    // the particles inside, by more than tolerance times the largest density
+    // found at a particle, or when it holds more than max_particles particles
+    double tolerance = 0.05;
+    unsigned int max_particles = 64;
+
+private:
+    struct Node
+    {
+        double x, y, size_x, size_y;
+        int depth;
+        int first_child;
+        float corners[4];
+    };
+
+    std::vector<Node> nodes;
+    double xmin = 0., ymin = 0., width = 0., height = 0.;
+
+    // Append the subtree of node in preorder
+    void collect(int node, std::vector<unsigned char>& split,
+                 std::vector<float>& corners) const;
+};
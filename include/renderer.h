@@ -0,0 +1,67 @@
+// File: renderer.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the in-situ renderer, which splats the particles
+// straight into an image while the simulation is running. This avoids
+// dumping full snapshots and plotting them afterwards just to make a movie.
+
+#pragma once
+
+#include "grid.h"
+#include "particle.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// The quantity that sets the color of each pixel
+enum class ColorField { density, speed, pressure };
+
+ColorField parse_color_field(const std::string& name);
+
+class Renderer
+{
+public:
+    Renderer() = default;
+    ~Renderer();
+
+    // The renderer may own an ffmpeg process, so it can't be copied
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    // Render one frame of the rectangle with lower left corner (xmin, ymin).
+    // name is used for the file name when writing frames to disk.
+    void render(const std::vector<SPHParticle>& particles,
+                double xmin, double ymin, double width, double height,
+                const std::string& name);
+
+    int pixels_x = 800;
+    int pixels_y = 800;
+    ColorField field = ColorField::density;
+
+    // "ppm" writes frames/<step>.ppm, "ffmpeg" pipes raw frames to ffmpeg,
+    // which encodes them into movie.mp4. Both are inside of directory.
+    std::string output = "ppm";
+    std::string directory;
+
+    // Color scale limits. If they are equal, each frame is scaled to its own
+    // minimum and maximum.
+    double value_min = 0.;
+    double value_max = 0.;
+
+    // Periodic axes of the rendered rectangle. Particles near the seam are
+    // also drawn on the opposite side.
+    Periodicity periodicity;
+
+private:
+    FILE* pipe = nullptr;
+
+    // Accumulated kernel weight and weighted value for each pixel
+    std::vector<double> weight;
+    std::vector<double> value;
+    std::vector<unsigned char> image;
+
+    void splat(const std::vector<SPHParticle>& particles,
+               double xmin, double ymin, double width, double height);
+    void color();
+    void write(const std::string& name);
+};
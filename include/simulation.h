@@ -10,51 +10,42 @@
 #include "geometry.h"
 #include "particle.h"
 #include "kernel.h"
+#include "renderer.h"
+#include "density_sampler.h"
+#include "grid.h"
+#include "quadtree.h"
+#include "precision.h"
+#include "integrator.h"
+#include "boundary.h"
+#include "static_boundary.h"
+#include "interpolator.h"
+#include "metrics.h"
+#include <array>
+#include <memory>
 #include <vector>
 #include <string>
 
-/*
-// The grid structure for tracking neighbors
-// On construction, calculate bounding box and determine cell size
-// from the particles, and then use a sorting function to sort the
-// particles for increased cache hits and ease/speed of access. After
-// sorting, neighbors are determined and tracked.
-class Grid
-{
-    double cell_size;
-
-    // Kitty corner vertices, 2 x dimension
-    arma::Mat<double> coordinate_limits;
-
-    // List of pointers with each pointer going to the first particle
-    // in the cell, represented either by a block of an array or a
-    // linked list
-
-
-};
-
-// Take in grid and sort particles according to the cell
-// index inherited from the grid
-void index_sort(Grid);
-
-// Sort according to z-curve, which has better spatial coherence
-// than index_sort() and is accessed quickly through bitwise operations
-void z_curve_sort(Grid);
-*/
-
 class Simulation
 {
 public:
     // Because of the Simulation's job of managing the computation,
     // it naturally needs to have manually defined constructor and destructor
-    Simulation();
+    // Outputs go to directory, which defaults to the working directory.
+    // Simulations given the same boundary_cache share prepared and binned
+    // boundaries.
+    Simulation(const std::string& input_name = "input.txt",
+               const std::string& _directory = "",
+               BoundaryCache* boundary_cache = nullptr);
     ~Simulation();
 
     int run();
-    int sample_density(int x_samples, int y_samples);
+    int sample_density(int x_samples, int y_samples,
+                       const std::string& name = "density.tsv");
+    int sample_density_adaptive(const std::string& name = "density.sphq");
 
 private:
     std::vector<SPHParticle> particles;
+    double xmin, ymin;
     double width, height;
     unsigned int step = 0;
     unsigned int max_step;
@@ -62,10 +53,93 @@ private:
     double duration;
     Polygon domain;
     double spacing;
-    std::vector<SPHParticle> boundary;
-    double boundary_thickness;
+    std::shared_ptr<const StaticBoundary> walls;
+    std::string boundary_file = "boundary.txt";
+    double boundary_thickness = 5.;
+
+    // Periodic axes of the bounding box, which need no boundary particles
+    Periodicity periodicity;
+
+    // Inflow and outflow edges of the polygon, and the steps between
+    // compactions of the particle store
+    FlowBoundaries flow;
+    unsigned int compact_interval = 100;
 
+    // Physics of the time integration
+    EquationOfState eos;
+    double gravity_x = 0.;
+    double gravity_y = -9.81;
+    double viscosity = 0.1;
+    bool pair_cache = true;
+    PressureSolver pressure_solver = PressureSolver::equation_of_state;
+    double solver_tolerance = 1e-3;
+    int solver_max_iterations = 100;
+    double solver_relaxation = 0.5;
+
+    // Performance parameters, which auto_tune picks by timing the steps,
+    // each trial taking tune_steps steps
+    Tuning tuning;
+    bool auto_tune = false;
+    unsigned int tune_steps = 10;
+    double tune_drift = 0.25;
+
+    template<typename Policy>
+    void configure(Integrator<Policy>& integrator) const;
+    template<typename Policy>
+    int integrate();
+    bool output_due(unsigned int _step) const;
+    bool metrics_due(unsigned int _step) const;
+    void output();
+
+    // Storage precision of the per particle inputs in the neighbor loops.
+    // The report compares every reduced precision against double, including
+    // the trajectories after precision_report_steps steps.
+    Precision precision = Precision::double_precision;
+    bool precision_report = false;
+    unsigned int precision_report_steps = 100;
+    double anchor_size = 1.;    // of the cell relative anchors
+    template<typename Policy>
+    std::vector<SPHParticle> trajectory(unsigned int steps) const;
+
+    // Steps between snapshots and rendered frames, 0 disables them
+    unsigned int dump_interval = 1;
+    unsigned int render_interval = 0;
+    Renderer renderer;
+
+    // Density field monitoring, sampled every sample_interval steps, either
+    // on a uniform grid or adaptively on a quadtree
+    unsigned int sample_interval = 0;
+    bool sample_adaptive = false;
+    int sample_x = 100;
+    int sample_y = 100;
+    DensitySampler density_sampler;
+    unsigned long long sampled_renumberings = 0;
+    Quadtree quadtree;
+
+    Grid grid;
+
+    // Probes record the interpolated density, pressure and velocity at
+    // fixed points every probe_interval steps, one row per step in
+    // data/probes.tsv. They read the integrator in place between steps.
+    unsigned int probe_interval = 0;
+    std::vector<std::array<double,2>> probes;
+    Interpolator interpolator;
+    std::ofstream probe_stream;
+    template<typename Policy>
+    int write_probes(const Integrator<Policy>& integrator);
+
+    // Live metrics are published to the shared memory ring metrics_name
+    // every metrics_interval steps, instead of logging every step
+    std::string metrics_name;
+    unsigned int metrics_interval = 10;
+    MetricsRing metrics;
+
+    std::string padded_step();
     int dump_state();
+    std::string directory;
+    std::ofstream log_file;
+    std::ostream* log = &std::cout;
+
     std::ifstream is;
     std::ofstream os;
     std::vector<std::string> next_line();
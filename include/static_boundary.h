@@ -0,0 +1,60 @@
+// File: static_boundary.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the store of the dummy boundary particles. They never
+// move, so they are binned once into their own grid instead of with the
+// fluid every step. Everything about them that doesn't depend on the fluid
+// is computed once as well, such as the volume of each particle: the area
+// it covers, the inverse of the kernel sum over the wall, so that a wall of
+// any spacing looks like fluid. A mask of the cells that are within reach of the wall lets fluid particles
+// far from every wall skip the boundary query after a single lookup.
+
+#pragma once
+
+#include "grid.h"
+#include "particle.h"
+#include <cstddef>
+#include <vector>
+
+class StaticBoundary
+{
+public:
+    StaticBoundary() = default;
+
+    // Bin the particles for queries out to radius, and compute their
+    // volumes. Only positions and ranges of the particles are used.
+    void build(const std::vector<SPHParticle>& particles,
+               const Periodicity& periodicity, double radius);
+
+    std::size_t size() const { return x.size(); }
+
+    // Whether any boundary particle may be within radius of (x, y). False
+    // means the query can be skipped.
+    bool near(double _x, double _y) const;
+
+    // Call visit(b, separation_x, separation_y) for every boundary particle
+    // b that may be within radius of (x, y), where the separation is from
+    // the nearest image of b to (x, y). The distance still needs a check.
+    template<typename Visit>
+    void for_each_candidate(double _x, double _y, Visit visit) const;
+
+    std::vector<double> x, y, range, volume;
+
+private:
+    Grid grid;
+    double radius = 0.;
+
+    // Cells holding a boundary particle, or next to one that does
+    std::vector<char> near_cell;
+};
+
+template<typename Visit>
+void StaticBoundary::for_each_candidate(double _x, double _y,
+                                        Visit visit) const
+{
+    grid.for_each_image(_x, _y, radius,
+        [&](unsigned int b, double shift_x, double shift_y)
+        {
+            visit(b, _x - x[b] - shift_x, _y - y[b] - shift_y);
+        });
+}
@@ -0,0 +1,95 @@
+// File: tuner.h
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// This header defines the performance parameters of the integrator, which
+// change how long a step takes but not what it computes, and a tuner that
+// picks them while the simulation runs. Their best values depend on the
+// particle count and distribution, and on the machine:
+//     cell_factor    grid cell size relative to the search radius. Smaller
+//                    cells cover less empty area around each particle, but
+//                    there are more of them to visit.
+//     skin           extra search radius, relative to the largest range. The
+//                    grid is only rebinned once a particle may have moved
+//                    further than the skin, at the cost of more candidates.
+//     sort_interval  steps between reorderings of the particle store into
+//                    grid order, which keeps neighbors close in memory. 0
+//                    never reorders.
+//     chunk_size     particles per OpenMP chunk in the neighbor sweeps, which
+//                    are scheduled dynamically unless it is 0
+//
+// The tuner times the steps themselves. Each parameter in turn is tried at
+// each of its candidates for trial_steps steps, after one step to let it take
+// effect, and the candidate with the fastest mean step is kept. The sort
+// interval is found from the cost C of one reordering and the growth a of the
+// step time after it instead, since reordering every sqrt(2C/a) steps gives
+// the fastest mean step. Once settled, tuning starts over if the particle
+// count or their number density over the grid drifts by more than drift.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct Tuning
+{
+    double cell_factor = 1.;
+    double skin = 0.;
+    unsigned int sort_interval = 0;
+    int chunk_size = 0;
+
+    // The parameters as input.txt lines
+    std::string describe() const;
+};
+
+class Tuner
+{
+public:
+    Tuner() = default;
+
+    // Start tuning, with the parameters not tuned yet taken from initial
+    void start(const Tuning& initial);
+
+    // Parameters for the next step
+    const Tuning& parameters() const { return current; }
+
+    // Whether the next step should reorder the particle store, and the time
+    // that the reordering took
+    bool sort_requested() const { return sort_pending; }
+    void record_sort(double seconds);
+
+    // Report the time of a step made with parameters(), and the live
+    // particles and area of the grid after it. Returns true when the step
+    // settled the parameters.
+    bool record(double seconds, std::size_t particles, double area);
+
+    bool settled() const { return phase == Phase::settled; }
+
+    // Times the parameters have been settled
+    unsigned int rounds() const { return settled_rounds; }
+
+    unsigned int trial_steps = 10;
+    double drift = 0.25;
+
+private:
+    enum class Phase { cell_factor, skin, chunk_size, sort_interval, settled };
+
+    Phase phase = Phase::settled;
+    Tuning best, current;
+    std::size_t candidate = 0;
+    std::vector<double> times;
+    double best_time = 0.;
+    bool taking_effect = false;
+
+    bool sort_pending = false;
+    double sort_seconds = 0.;
+
+    // Particle count and number density when the parameters were settled
+    std::size_t reference_particles = 0;
+    double reference_density = 0.;
+    unsigned int settled_rounds = 0;
+
+    std::size_t candidates() const;
+    void try_candidate();
+    void next_phase();
+};
@@ -0,0 +1,106 @@
+import mmap
+import struct
+import sys
+import time
+
+# Reader for the live metrics ring written by MetricsRing while a simulation
+# runs. The layout is documented in include/metrics.h.
+#     python3 read_metrics.py <name>        print the records in the ring
+#     python3 read_metrics.py <name> -f     follow new records until the
+#                                           simulation finishes
+# Output is tab separated, with a header row, so it can be piped on.
+
+HEADER = struct.Struct('=4sIIIQII32x')
+RECORD = struct.Struct('=QQQ9dQ')
+FIELDS = ('step', 'particles', 'time', 'dt', 'steps_per_second',
+          'pairs_per_second', 'kinetic_energy', 'potential_energy',
+          'internal_energy', 'momentum_x', 'momentum_y', 'resident_bytes')
+FINISHED = 2
+POLL_SECONDS = 0.2
+
+
+def attach(name):
+    with open('/dev/shm/' + name.lstrip('/'), 'rb') as f:
+        ring = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+    magic, version, capacity, record_size = HEADER.unpack_from(ring, 0)[:4]
+    if magic != b'SPHM':
+        raise ValueError(name + ' is not a metrics ring')
+    if version != 2:
+        raise ValueError(name + ' has unsupported version ' + str(version))
+    return ring, capacity, record_size
+
+
+def head_and_state(ring):
+    header = HEADER.unpack_from(ring, 0)
+    return header[4], header[5]
+
+
+def read_record(ring, capacity, record_size, n):
+    # The copy is only good if the sequence says the slot held record n both
+    # before and after it. Otherwise the writer was in the middle of it, or
+    # has already lapped the reader.
+    offset = HEADER.size + (n % capacity) * record_size
+    for attempt in range(3):
+        values = RECORD.unpack_from(ring, offset)
+        sequence = struct.unpack_from('=Q', ring, offset)[0]
+        if values[0] == sequence == 2 * n + 2:
+            return dict(zip(FIELDS, values[1:]))
+        if sequence > 2 * n + 2:
+            return None
+    return None
+
+
+def format_record(record):
+    energy = (record['kinetic_energy'] + record['potential_energy']
+              + record['internal_energy'])
+    return '\t'.join([
+        str(record['step']), '%g' % record['time'], '%g' % record['dt'],
+        '%.1f' % record['steps_per_second'],
+        '%.3g' % record['pairs_per_second'],
+        '%.10g' % energy, '%.10g' % record['kinetic_energy'],
+        '%.10g' % record['internal_energy'],
+        '%.6g' % record['momentum_x'], '%.6g' % record['momentum_y'],
+        str(record['particles']),
+        '%.1f' % (record['resident_bytes'] / 2**20)])
+
+
+def read_metrics(name, follow):
+    ring, capacity, record_size = attach(name)
+    print('step\ttime\tdt\tsteps/s\tpairs/s\tenergy\tkinetic\tinternal\t'
+          'momentum_x\tmomentum_y\tparticles\tmemory_MiB', flush=True)
+
+    # Following starts from the latest record, printing starts from the
+    # oldest one still in the ring
+    head, state = head_and_state(ring)
+    n = max(0, head - 1) if follow else max(0, head - capacity)
+    while True:
+        head, state = head_and_state(ring)
+        if head < n:
+            # A new simulation took over the segment
+            n = 0
+        if head - n > capacity:
+            print('# skipped %d records' % (head - capacity - n),
+                  file=sys.stderr)
+            n = head - capacity
+        while n < head:
+            record = read_record(ring, capacity, record_size, n)
+            if record is not None:
+                print(format_record(record), flush=True)
+            n += 1
+        if not follow or state == FINISHED:
+            break
+        time.sleep(POLL_SECONDS)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print('usage: read_metrics.py <name> [-f]', file=sys.stderr)
+        sys.exit(1)
+    try:
+        read_metrics(sys.argv[1], '-f' in sys.argv[2:])
+    except FileNotFoundError:
+        print('no metrics ring named ' + sys.argv[1], file=sys.stderr)
+        sys.exit(1)
+    except KeyboardInterrupt:
+        pass
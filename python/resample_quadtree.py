@@ -0,0 +1,75 @@
+import struct
+import sys
+import numpy as np
+import matplotlib.pyplot as plt
+
+# Reader for the adaptive density output written by Quadtree::write().
+# The layout is documented in include/quadtree.h. It is in native byte
+# order, so the file is read on the machine that wrote it.
+
+
+def read_quadtree(name):
+    with open(name, 'rb') as f:
+        data = f.read()
+
+    if data[:4] != b'SPHQ':
+        raise ValueError(name + ' is not a quadtree file')
+    version, node_count = struct.unpack_from('=IQ', data, 4)
+    if version != 1:
+        raise ValueError(name + ' has unsupported version ' + str(version))
+    extent = struct.unpack_from('=4d', data, 16)
+    max_depth = struct.unpack_from('=I', data, 48)[0]
+    split = np.frombuffer(data, dtype=np.uint8, count=node_count, offset=56)
+    corners = np.frombuffer(data, dtype=np.float32,
+                            offset=56 + node_count).reshape(-1, 4)
+
+    # Walk the preorder split flags to recover the rectangle of every leaf
+    leaves = []
+    stack = [(extent[0], extent[1], extent[2], extent[3])]
+    for flag in split:
+        x, y, size_x, size_y = stack.pop()
+        if flag:
+            half_x = 0.5 * size_x
+            half_y = 0.5 * size_y
+            # Pushed in reverse so children pop in the stored order
+            for child in (3, 2, 1, 0):
+                stack.append((x + (child & 1) * half_x,
+                              y + (child >> 1) * half_y, half_x, half_y))
+        else:
+            leaves.append((x, y, size_x, size_y))
+
+    return extent, max_depth, np.array(leaves), corners
+
+
+def resample(name, x_samples, y_samples):
+    # Bilinearly interpolate each leaf onto the sample points it holds. The
+    # points and indexing [i, j] are the same as in density.tsv.
+    extent, max_depth, leaves, corners = read_quadtree(name)
+    xmin, ymin, width, height = extent
+    dx = width / x_samples
+    dy = height / y_samples
+    field = np.zeros((x_samples, y_samples))
+
+    for (x, y, size_x, size_y), values in zip(leaves, corners):
+        i0 = int(np.ceil((x - xmin) / dx))
+        i1 = min(x_samples, int(np.ceil((x + size_x - xmin) / dx)))
+        j0 = int(np.ceil((y - ymin) / dy))
+        j1 = min(y_samples, int(np.ceil((y + size_y - ymin) / dy)))
+        if i1 <= i0 or j1 <= j0:
+            continue
+        s = (np.arange(i0, i1) * dx + xmin - x) / size_x
+        t = (np.arange(j0, j1) * dy + ymin - y) / size_y
+        s, t = np.meshgrid(s, t, indexing='ij')
+        field[i0:i1, j0:j1] = ((1 - s) * (1 - t) * values[0]
+                               + s * (1 - t) * values[1]
+                               + (1 - s) * t * values[2]
+                               + s * t * values[3])
+
+    return field
+
+
+if __name__ == '__main__':
+    name = sys.argv[1] if len(sys.argv) > 1 else 'density.sphq'
+    samples = int(sys.argv[2]) if len(sys.argv) > 2 else 1000
+    plt.imshow(resample(name, samples, samples))
+    plt.show()
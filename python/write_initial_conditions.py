@@ -0,0 +1,38 @@
+import numpy as np
+
+# Writers for the binary initial condition files read by loader.cpp.
+# The layouts are documented in include/loader.h.
+
+
+def write_particles(name, position, velocity, mass, range_):
+    count = len(mass)
+    with open(name, 'wb') as f:
+        f.write(b'SPHP')
+        np.array([1], dtype=np.uint32).tofile(f)
+        np.array([count], dtype=np.uint64).tofile(f)
+        for column in (position[:, 0], position[:, 1],
+                       velocity[:, 0], velocity[:, 1], mass, range_):
+            np.ascontiguousarray(column, dtype=np.float64).tofile(f)
+
+
+def write_vertices(name, vertices):
+    with open(name, 'wb') as f:
+        f.write(b'SPHV')
+        np.array([1], dtype=np.uint32).tofile(f)
+        np.array([len(vertices)], dtype=np.uint64).tofile(f)
+        np.ascontiguousarray(vertices, dtype=np.float64).tofile(f)
+
+
+if __name__ == '__main__':
+    # Dam break in the unit square, on a perturbed lattice
+    vertices = np.array([[0., 0.], [1., 0.], [1., 1.], [0., 1.]])
+    spacing = 0.01
+    x, y = np.meshgrid(np.arange(spacing, 0.5, spacing),
+                       np.arange(spacing, 0.5, spacing))
+    position = np.column_stack((x.ravel(), y.ravel()))
+    position += np.random.uniform(-0.1, 0.1, position.shape) * spacing
+    count = len(position)
+
+    write_particles('particles.bin', position, np.zeros((count, 2)),
+                    np.ones(count), np.full(count, 0.1))
+    write_vertices('vertices.bin', vertices)
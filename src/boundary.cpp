@@ -0,0 +1,228 @@
+// File: boundary.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the boundary.h header
+//
+
+#include "boundary.h"
+#include "loader.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// Read "x y" lines, skipping blank and comment lines
+static Polygon read_polygon(const std::string& polygon_file)
+{
+    std::ifstream is(polygon_file);
+    if (!is)
+        throw std::runtime_error("could not open " + polygon_file);
+
+    Polygon domain;
+    std::string line;
+    while (std::getline(is, line))
+    {
+        if (line.length() == 0 || line[0] == '#')
+            continue;
+        std::istringstream tokens(line);
+        double x, y;
+        if (!(tokens >> x >> y))
+            throw std::invalid_argument("bad vertex in " + polygon_file
+                                        + ": " + line);
+        domain.vertices.push_back(arma::vec({x, y}));
+    }
+    if (domain.vertices.size() < 3)
+        throw std::invalid_argument(polygon_file
+                                    + " has fewer than 3 vertices");
+
+    return domain;
+}
+
+std::vector<bool> wall_edges(const Polygon& domain,
+                             const Periodicity& periodicity,
+                             const std::vector<int>& open_edges)
+{
+    // The box is rebuilt from the vertices, so allow for rounding
+    auto on_side = [](double a, double b, double low, double length)
+    {
+        const double tolerance = 1e-9*length;
+        return std::abs(a-b) <= tolerance
+            && (std::abs(a-low) <= tolerance
+                || std::abs(a-low-length) <= tolerance);
+    };
+
+    std::vector<bool> wall(domain.vertices.size(), true);
+    for (std::size_t i = 0; i<domain.vertices.size(); i++)
+    {
+        const arma::vec& a = domain.vertices[i];
+        const arma::vec& b = domain.vertices[(i+1)%domain.vertices.size()];
+        if (periodicity.x && on_side(a(0), b(0), periodicity.xmin,
+                                     periodicity.length_x))
+            wall[i] = false;
+        if (periodicity.y && on_side(a(1), b(1), periodicity.ymin,
+                                     periodicity.length_y))
+            wall[i] = false;
+    }
+    for (int edge : open_edges)
+    {
+        if (edge >= 0 && edge < (int)wall.size())
+            wall[edge] = false;
+    }
+    return wall;
+}
+
+PreparedBoundary prepare_boundary(const std::string& polygon_file,
+                                  bool binary, double spacing,
+                                  double thickness, bool periodic_x,
+                                  bool periodic_y,
+                                  const std::vector<int>& open_edges)
+{
+    PreparedBoundary prepared;
+    Polygon& domain = prepared.domain;
+    domain = binary ? load_vertices(polygon_file) : read_polygon(polygon_file);
+
+    double& xmin = prepared.xmin;
+    double& xmax = prepared.xmax;
+    double& ymin = prepared.ymin;
+    double& ymax = prepared.ymax;
+    xmin = xmax = domain.vertices[0](0);
+    ymin = ymax = domain.vertices[0](1);
+    
+    for (auto vertex : domain.vertices)
+    {
+        if (vertex(0) < xmin)
+            xmin = vertex(0);
+        else if (vertex(0) > xmax)
+            xmax = vertex(0);
+        if (vertex(1) < ymin)
+            ymin = vertex(1);
+        else if (vertex(1) > ymax)
+            ymax = vertex(1);
+    }
+
+    // Along a periodic axis the lattice is shifted by half a spacing, and
+    // the spacing is stretched so that it repeats seamlessly
+    const double margin = thickness*spacing;
+    double x_start = xmin-margin, x_end = xmax+margin, x_spacing = spacing;
+    double y_start = ymin-margin, y_end = ymax+margin, y_spacing = spacing;
+    if (periodic_x)
+    {
+        x_spacing = (xmax-xmin) / std::max(1., std::round((xmax-xmin)/spacing));
+        x_start = xmin + 0.5*x_spacing;
+        x_end = xmax;
+    }
+    if (periodic_y)
+    {
+        y_spacing = (ymax-ymin) / std::max(1., std::round((ymax-ymin)/spacing));
+        y_start = ymin + 0.5*y_spacing;
+        y_end = ymax;
+    }
+
+    Periodicity periodicity;
+    periodicity.x = periodic_x;
+    periodicity.y = periodic_y;
+    periodicity.xmin = xmin;
+    periodicity.ymin = ymin;
+    periodicity.length_x = xmax-xmin;
+    periodicity.length_y = ymax-ymin;
+    const std::vector<bool> wall = wall_edges(domain, periodicity,
+                                              open_edges);
+
+    arma::vec point;
+    for (double x = x_start; x <= x_end; x += x_spacing)
+    {
+        for (double y = y_start; y <= y_end; y += y_spacing)
+        {
+            point = {x,y};
+            if (point_inside_polygon(point, domain) == 0)
+            {
+                for (int i = 0; i<domain.vertices.size(); i++)
+                {
+                    if (!wall[i])
+                        continue;
+                    double distance = distance_to_line_segment(
+                        point,
+                        Line_Segment(
+                            domain.vertices[i],
+                            domain.vertices[(i+1)
+                                %domain.vertices.size()]));
+
+                    if ( distance <= thickness*spacing )
+                    {
+                        prepared.particles.push_back(SPHParticle());
+                        prepared.particles.back().position = point;
+                        // Only one particle, even if near several edges
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    return prepared;
+}
+
+StaticBoundary build_walls(const PreparedBoundary& prepared,
+                           const Periodicity& periodicity, double range,
+                           double radius)
+{
+    std::vector<SPHParticle> particles = prepared.particles;
+    for (SPHParticle& particle : particles)
+    {
+        particle.velocity = {0.,0.};
+        particle.mass = 0.;
+        particle.range = range;
+        particle.pressure = 0.;
+    }
+    StaticBoundary walls;
+    walls.build(particles, periodicity, radius);
+    return walls;
+}
+
+std::shared_ptr<const PreparedBoundary> BoundaryCache::get(
+    const std::string& polygon_file, bool binary, double spacing,
+    double thickness, bool periodic_x, bool periodic_y,
+    const std::vector<int>& open_edges)
+{
+    std::ostringstream key;
+    key.precision(17);
+    key << polygon_file << '\n' << binary << '\n' << spacing << '\n'
+        << thickness << '\n' << periodic_x << periodic_y;
+    for (int edge : open_edges)
+        key << ' ' << edge;
+
+    // Holding the lock while preparing makes other simulations wait for
+    // the result, instead of preparing the same boundary again
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = prepared.find(key.str());
+    if (found != prepared.end())
+        return found->second;
+
+    auto boundary = std::make_shared<const PreparedBoundary>(
+        prepare_boundary(polygon_file, binary, spacing, thickness,
+                         periodic_x, periodic_y, open_edges));
+    prepared[key.str()] = boundary;
+    return boundary;
+}
+
+std::shared_ptr<const StaticBoundary> BoundaryCache::walls(
+    const std::shared_ptr<const PreparedBoundary>& boundary,
+    const Periodicity& periodicity, double range, double radius)
+{
+    // The cache keeps every prepared boundary alive, so its address is a
+    // key for it
+    std::ostringstream key;
+    key.precision(17);
+    key << boundary.get() << '\n' << range << '\n' << radius;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = binned.find(key.str());
+    if (found != binned.end())
+        return found->second;
+
+    auto built = std::make_shared<const StaticBoundary>(
+        build_walls(*boundary, periodicity, range, radius));
+    binned[key.str()] = built;
+    return built;
+}
@@ -0,0 +1,219 @@
+// File: density_sampler.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the density_sampler.h header
+//
+
+#include "density_sampler.h"
+#include "kernel.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+void DensitySampler::resize(int _x_samples, int _y_samples,
+                            double _xmin, double _ymin,
+                            double width, double height)
+{
+    if (_x_samples <= 0 || _y_samples <= 0)
+        throw std::invalid_argument("Either x_samples or y_samples is zero");
+    if (tile_size <= 0)
+        throw std::invalid_argument("tile_size must be positive");
+
+    const double _dx = width / (double)_x_samples;
+    const double _dy = height / (double)_y_samples;
+    if (!stale && _x_samples == x_samples && _y_samples == y_samples
+        && _xmin == xmin && _ymin == ymin && _dx == dx && _dy == dy)
+        return;
+
+    x_samples = _x_samples;
+    y_samples = _y_samples;
+    xmin = _xmin;
+    ymin = _ymin;
+    dx = _dx;
+    dy = _dy;
+    tiles_x = (x_samples + tile_size - 1) / tile_size;
+    tiles_y = (y_samples + tile_size - 1) / tile_size;
+
+    samples.assign(x_samples*y_samples, 0.);
+    dirty.assign(tiles_x*tiles_y, 1);
+    previous.clear();
+    stale = true;
+}
+
+template<typename Visit>
+void DensitySampler::for_each_tile(const Footprint& footprint,
+                                   Visit visit) const
+{
+    double shift_x[9], shift_y[9];
+    const int images = periodicity.images(footprint.x, footprint.y,
+                                          footprint.range, shift_x, shift_y);
+    for (int k=0; k<images; k++)
+    {
+        const double x = footprint.x + shift_x[k];
+        const double y = footprint.y + shift_y[k];
+        int i_start = std::max(0,
+            (int)std::ceil((x - footprint.range - xmin) / dx));
+        int i_end = std::min(x_samples-1,
+            (int)std::floor((x + footprint.range - xmin) / dx));
+        int j_start = std::max(0,
+            (int)std::ceil((y - footprint.range - ymin) / dy));
+        int j_end = std::min(y_samples-1,
+            (int)std::floor((y + footprint.range - ymin) / dy));
+        if (i_start > i_end || j_start > j_end)
+            continue;
+
+        for (int tile_i = i_start/tile_size; tile_i <= i_end/tile_size;
+             tile_i++)
+            for (int tile_j = j_start/tile_size; tile_j <= j_end/tile_size;
+                 tile_j++)
+                visit(tile_i*tiles_y + tile_j);
+    }
+}
+
+int DensitySampler::update(const std::vector<SPHParticle>& particles)
+{
+    if (x_samples == 0)
+        throw std::invalid_argument("DensitySampler used before resize");
+
+    const long long count = particles.size();
+    const long long old_count = previous.size();
+
+    // Mark the tiles under both the old and new footprint of every particle
+    // that changed by more than the tolerance, and remember its new state.
+    // Particles that appeared or disappeared only have one footprint.
+    if (!stale)
+    {
+        const long long checked = std::max(count, old_count);
+        #pragma omp parallel for schedule(static)
+        for (long long n=0; n<checked; n++)
+        {
+            auto mark = [this](int tile)
+            {
+                #pragma omp atomic write
+                dirty[tile] = 1;
+            };
+
+            if (n >= count)
+            {
+                for_each_tile(previous[n], mark);
+                continue;
+            }
+
+            const SPHParticle& particle = particles[n];
+            Footprint current = {particle.position(0), particle.position(1),
+                                 particle.mass, particle.range};
+            if (n >= old_count)
+            {
+                for_each_tile(current, mark);
+                continue;
+            }
+
+            Footprint& old = previous[n];
+            const double moved = std::hypot(current.x-old.x, current.y-old.y);
+            if (moved > tolerance || current.mass != old.mass
+                || current.range != old.range)
+            {
+                for_each_tile(old, mark);
+                for_each_tile(current, mark);
+                old = current;
+            }
+        }
+    }
+
+    // Fresh snapshot of anything not carried over from the last update
+    previous.resize(count);
+    #pragma omp parallel for schedule(static)
+    for (long long n=(stale ? 0 : old_count); n<count; n++)
+    {
+        previous[n] = {particles[n].position(0), particles[n].position(1),
+                       particles[n].mass, particles[n].range};
+    }
+    stale = false;
+
+    std::vector<int> dirty_tiles;
+    std::vector<int> slot(dirty.size(), -1);
+    for (int tile=0; tile<(int)dirty.size(); tile++)
+    {
+        if (dirty[tile])
+        {
+            slot[tile] = dirty_tiles.size();
+            dirty_tiles.push_back(tile);
+        }
+    }
+    if (dirty_tiles.empty())
+        return 0;
+
+    // Bin the particles that reach into dirty tiles. Clean tiles keep their
+    // samples, so they don't need to know about any particles.
+    std::vector<std::vector<unsigned int>> members(dirty_tiles.size());
+    for (long long n=0; n<count; n++)
+    {
+        // Images of one particle may reach the same tile
+        for_each_tile(previous[n], [&](int tile)
+        {
+            if (slot[tile] >= 0 && (members[slot[tile]].empty()
+                                    || members[slot[tile]].back() != n))
+                members[slot[tile]].push_back(n);
+        });
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int k=0; k<(int)dirty_tiles.size(); k++)
+    {
+        recompute_tile(dirty_tiles[k], members[k]);
+        dirty[dirty_tiles[k]] = 0;
+    }
+
+    return dirty_tiles.size();
+}
+
+// The tile is computed from the stored footprints rather than the current
+// particles, so that the whole field always matches one consistent state
+void DensitySampler::recompute_tile(int tile,
+                                    const std::vector<unsigned int>& members)
+{
+    const int tile_i = tile / tiles_y;
+    const int tile_j = tile % tiles_y;
+    const int i_start = tile_i*tile_size;
+    const int i_end = std::min(x_samples, i_start+tile_size) - 1;
+    const int j_start = tile_j*tile_size;
+    const int j_end = std::min(y_samples, j_start+tile_size) - 1;
+
+    for (int i=i_start; i<=i_end; i++)
+        for (int j=j_start; j<=j_end; j++)
+            samples[i*y_samples + j] = 0.;
+
+    double shift_x[9], shift_y[9];
+    for (unsigned int n : members)
+    {
+        const Footprint& footprint = previous[n];
+        const double range = footprint.range;
+        const int images = periodicity.images(footprint.x, footprint.y,
+                                              range, shift_x, shift_y);
+        for (int k=0; k<images; k++)
+        {
+            const double x = footprint.x + shift_x[k];
+            const double y = footprint.y + shift_y[k];
+
+            int first_i = std::max(i_start, (int)std::ceil((x-range-xmin)/dx));
+            int last_i = std::min(i_end, (int)std::floor((x+range-xmin)/dx));
+            int first_j = std::max(j_start, (int)std::ceil((y-range-ymin)/dy));
+            int last_j = std::min(j_end, (int)std::floor((y+range-ymin)/dy));
+
+            for (int i=first_i; i<=last_i; i++)
+            {
+                const double separation_x = xmin + i*dx - x;
+                for (int j=first_j; j<=last_j; j++)
+                {
+                    const double separation_y = ymin + j*dy - y;
+                    const double distance = std::sqrt(
+                        separation_x*separation_x
+                        + separation_y*separation_y);
+                    samples[i*y_samples + j] += footprint.mass
+                        * cubic_sph_kernel_2d(distance / range)
+                        / (range*range);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,282 @@
+// File: ensemble.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the ensemble.h header
+//
+
+#include "ensemble.h"
+#include "simulation.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Split a line on whitespace, or return nothing for blank and comment lines
+static std::vector<std::string> tokenize(const std::string& line)
+{
+    std::vector<std::string> tokens;
+    if (line.length() == 0 || line[0] == '#')
+        return tokens;
+    std::istringstream stream(line);
+    std::string token;
+    while (stream >> token)
+        tokens.push_back(token);
+    return tokens;
+}
+
+Ensemble::Ensemble(const std::string& specification)
+{
+    std::ifstream is(specification);
+    if (!is)
+        throw std::runtime_error("could not open " + specification);
+
+    std::string line;
+    while (std::getline(is, line))
+    {
+        std::vector<std::string> tokens = tokenize(line);
+        if (tokens.empty())
+            continue;
+        else if (tokens[0] == "base")
+            base = tokens.at(1);
+        else if (tokens[0] == "output")
+            output = tokens.at(1);
+        else if (tokens[0] == "workers")
+            workers = stoi(tokens.at(1));
+        else if (tokens[0] == "member_threads")
+            member_threads = std::max(1, stoi(tokens.at(1)));
+        else if (tokens[0] == "sweep")
+        {
+            if (tokens.size() < 3)
+                throw std::invalid_argument("sweep needs a parameter and "
+                                            "at least one value");
+            sweeps.push_back({tokens[1], std::vector<std::string>(
+                tokens.begin()+2, tokens.end())});
+        }
+        else
+            throw std::invalid_argument("unknown ensemble parameter "
+                                        + tokens[0]);
+    }
+
+    if (workers == 0)
+        workers = std::max(1u, std::thread::hardware_concurrency()
+                               / member_threads);
+
+    expand();
+}
+
+// Make one member for every combination of the swept values, and estimate
+// how long each will take from its particle and step counts
+void Ensemble::expand()
+{
+    std::vector<std::string> lines;
+    double particle_num = 0., timestep = 1., duration = 0.;
+    {
+        std::ifstream is(base);
+        if (!is)
+            throw std::runtime_error("could not open " + base);
+        std::string line;
+        while (std::getline(is, line))
+        {
+            std::vector<std::string> tokens = tokenize(line);
+            if (tokens.size() < 2)
+                continue;
+            if (tokens[0] == "particle_num")
+                particle_num = stod(tokens[1]);
+            else if (tokens[0] == "timestep")
+                timestep = stod(tokens[1]);
+            else if (tokens[0] == "duration")
+                duration = stod(tokens[1]);
+        }
+    }
+
+    std::size_t count = 1;
+    for (const auto& sweep : sweeps)
+        count *= sweep.second.size();
+
+    const int digits = std::to_string(count > 1 ? count-1 : 0).length();
+    for (std::size_t index=0; index<count; index++)
+    {
+        Member member;
+        std::string number = std::to_string(index);
+        number.insert(number.begin(), digits - number.length(), '0');
+        member.directory = output + "/" + number;
+
+        // Mixed radix decomposition of the index picks one value per sweep
+        std::size_t remainder = index;
+        double member_particles = particle_num;
+        double member_timestep = timestep;
+        double member_duration = duration;
+        for (auto sweep = sweeps.rbegin(); sweep != sweeps.rend(); ++sweep)
+        {
+            const std::string& value =
+                sweep->second[remainder % sweep->second.size()];
+            remainder /= sweep->second.size();
+            member.parameters.insert(member.parameters.begin(),
+                                     {sweep->first, value});
+
+            if (sweep->first == "particle_num")
+                member_particles = stod(value);
+            else if (sweep->first == "timestep")
+                member_timestep = stod(value);
+            else if (sweep->first == "duration")
+                member_duration = stod(value);
+        }
+        member.cost = member_particles * member_duration / member_timestep;
+
+        members.push_back(member);
+    }
+}
+
+// Write the base input with the member's parameters substituted, so the
+// member directory records exactly what was run
+void Ensemble::write_input(const Member& member) const
+{
+    std::ifstream is(base);
+    std::ofstream os(member.directory + "/input.txt");
+    if (!os)
+        throw std::runtime_error("could not write to " + member.directory);
+
+    std::vector<bool> written(member.parameters.size(), false);
+    auto format = [](const std::pair<std::string, std::string>& parameter)
+    {
+        std::string value = parameter.second;
+        std::replace(value.begin(), value.end(), ',', ' ');
+        return parameter.first + ' ' + value;
+    };
+
+    std::string line;
+    while (std::getline(is, line))
+    {
+        std::vector<std::string> tokens = tokenize(line);
+        for (std::size_t k=0; k<member.parameters.size(); k++)
+        {
+            if (!tokens.empty() && tokens[0] == member.parameters[k].first)
+            {
+                line = format(member.parameters[k]);
+                written[k] = true;
+            }
+        }
+        os << line << '\n';
+    }
+    for (std::size_t k=0; k<member.parameters.size(); k++)
+    {
+        if (!written[k])
+            os << format(member.parameters[k]) << '\n';
+    }
+}
+
+int Ensemble::run_member(const Member& member)
+{
+    try
+    {
+        Simulation simulation(member.directory + "/input.txt",
+                              member.directory, &boundary_cache);
+        simulation.run();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << member.directory << ": " << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
+
+int Ensemble::run()
+{
+    system(("mkdir -p " + output).c_str());
+
+    std::ofstream index(output + "/members.tsv");
+    index << "directory";
+    for (const auto& sweep : sweeps)
+        index << '\t' << sweep.first;
+    index << '\n';
+    for (const Member& member : members)
+    {
+        system(("mkdir -p " + member.directory).c_str());
+        write_input(member);
+        index << member.directory;
+        for (const auto& parameter : member.parameters)
+            index << '\t' << parameter.second;
+        index << '\n';
+    }
+    index.close();
+
+    // Deal out the most expensive members first, so that the cheap ones
+    // fill in the gaps at the end. Workers take from the front of their own
+    // queue, and steal from the back of the others.
+    std::vector<std::size_t> order(members.size());
+    for (std::size_t k=0; k<order.size(); k++)
+        order[k] = k;
+    std::stable_sort(order.begin(), order.end(),
+        [this](std::size_t a, std::size_t b)
+        { return members[a].cost > members[b].cost; });
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+    std::vector<WorkQueue> queues(workers);
+    for (std::size_t k=0; k<order.size(); k++)
+        queues[k % workers].tasks.push_back(order[k]);
+
+    std::atomic<int> failures(0);
+    std::atomic<std::size_t> finished(0);
+    std::mutex print;
+
+    auto work = [&](unsigned int worker)
+    {
+#ifdef _OPENMP
+        omp_set_num_threads(member_threads);
+#endif
+        while (true)
+        {
+            bool found = false;
+            std::size_t task = 0;
+            for (unsigned int k=0; k<workers && !found; k++)
+            {
+                WorkQueue& queue = queues[(worker+k) % workers];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty())
+                    continue;
+                if (k == 0)
+                {
+                    task = queue.tasks.front();
+                    queue.tasks.pop_front();
+                }
+                else
+                {
+                    task = queue.tasks.back();
+                    queue.tasks.pop_back();
+                }
+                found = true;
+            }
+            // Nothing is ever added, so empty queues mean all work is taken
+            if (!found)
+                return;
+
+            failures += run_member(members[task]);
+
+            std::lock_guard<std::mutex> lock(print);
+            std::cout << "Finished " << members[task].directory << " ("
+                      << ++finished << '/' << members.size() << ")\n";
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int worker=0; worker<workers; worker++)
+        threads.emplace_back(work, worker);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    return failures;
+}
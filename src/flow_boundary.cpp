@@ -0,0 +1,209 @@
+// File: flow_boundary.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the flow_boundary.h header
+//
+
+#include "flow_boundary.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+std::vector<int> FlowBoundaries::open_edges() const
+{
+    std::vector<int> edges = outflows;
+    for (const Inflow& inflow : inflows)
+        edges.push_back(inflow.edge);
+    return edges;
+}
+
+void FlowBoundaries::prepare(const Polygon& domain)
+{
+    const int vertex_count = domain.vertices.size();
+    auto make_edge = [&](int i)
+    {
+        if (i < 0 || i >= vertex_count)
+            throw std::invalid_argument("no polygon edge "
+                                        + std::to_string(i));
+        const arma::vec& start = domain.vertices[i];
+        const arma::vec& end = domain.vertices[(i+1)%vertex_count];
+
+        Edge edge;
+        edge.start_x = start(0);
+        edge.start_y = start(1);
+        edge.length = arma::norm(end - start);
+        if (edge.length == 0.)
+            throw std::invalid_argument("polygon edge "
+                                        + std::to_string(i)
+                                        + " has no length");
+        edge.tangent_x = (end(0) - start(0)) / edge.length;
+        edge.tangent_y = (end(1) - start(1)) / edge.length;
+
+        // Turn the normal to face the inside of the polygon
+        edge.normal_x = -edge.tangent_y;
+        edge.normal_y = edge.tangent_x;
+        const arma::vec probe = 0.5*(start + end) + 1e-6*edge.length
+            * arma::vec({edge.normal_x, edge.normal_y});
+        if (!point_inside_polygon(probe, domain))
+        {
+            edge.normal_x = -edge.normal_x;
+            edge.normal_y = -edge.normal_y;
+        }
+        return edge;
+    };
+
+    inflow_edges.clear();
+    outflow_edges.clear();
+    for (const Inflow& inflow : inflows)
+    {
+        if (inflow.speed <= 0.)
+            throw std::invalid_argument("inflow speed must be positive");
+        inflow_edges.push_back(make_edge(inflow.edge));
+    }
+    for (int edge : outflows)
+        outflow_edges.push_back(make_edge(edge));
+    travelled.assign(inflows.size(), 0.);
+}
+
+void FlowBoundaries::set_fluid(double rest_density, double mean_mass,
+                               double mean_range)
+{
+    range = mean_range;
+    spacings.clear();
+    masses.clear();
+    for (std::size_t k=0; k<inflows.size(); k++)
+    {
+        // A whole number of particles fits along the edge, and each one
+        // carries the mass of its square of fluid at rest density
+        double spacing = inflows[k].spacing;
+        if (spacing <= 0.)
+            spacing = std::sqrt(mean_mass / rest_density);
+        const double length = inflow_edges[k].length;
+        const double along = length / std::max(1., std::round(length/spacing));
+        spacings.push_back(spacing);
+        masses.push_back(rest_density * spacing * along);
+    }
+}
+
+template<typename Policy>
+std::size_t FlowBoundaries::exchange(ParticleStore<Policy>& store, double dt,
+                                     std::vector<std::size_t>& inserted)
+{
+    std::size_t removed = 0;
+    if (empty())
+        return removed;
+
+    // A particle has left when it is behind an open edge, within a kernel
+    // range of its ends. Leaving through an inflow edge shouldn't happen,
+    // but if it does the particle is removed as well.
+    {
+        std::vector<char> leaving(store.size(), 0);
+        #pragma omp parallel for schedule(static)
+        for (long long n=0; n<(long long)store.size(); n++)
+        {
+            if (!store.active[n])
+                continue;
+            const std::array<double,2> point = store.position(n);
+            for (const std::vector<Edge>* edges :
+                 {&outflow_edges, &inflow_edges})
+            {
+                for (const Edge& edge : *edges)
+                {
+                    double depth, along;
+                    locate(edge, point[0], point[1], depth, along);
+                    if (depth < 0. && along > -range
+                        && along < edge.length + range)
+                        leaving[n] = 1;
+                }
+            }
+        }
+        for (std::size_t n=0; n<store.size(); n++)
+        {
+            if (leaving[n])
+            {
+                store.remove(n);
+                removed++;
+            }
+        }
+    }
+
+    // The last row was emitted half a spacing inside of the edge, so once
+    // it has moved one spacing the next row fits behind it
+    for (std::size_t k=0; k<inflow_edges.size(); k++)
+    {
+        const Edge& edge = inflow_edges[k];
+        const double speed = inflows[k].speed;
+        const double spacing = spacings[k];
+        const int count = std::max(1., std::round(edge.length/spacing));
+        const double along = edge.length / count;
+
+        travelled[k] += speed*dt;
+        while (travelled[k] >= spacing)
+        {
+            travelled[k] -= spacing;
+            const double depth = 0.5*spacing + travelled[k];
+            for (int i=0; i<count; i++)
+            {
+                inserted.push_back(store.insert(
+                    edge.start_x + (i+0.5)*along*edge.tangent_x
+                        + depth*edge.normal_x,
+                    edge.start_y + (i+0.5)*along*edge.tangent_y
+                        + depth*edge.normal_y,
+                    speed*edge.normal_x, speed*edge.normal_y,
+                    masses[k], range));
+            }
+        }
+    }
+
+    return removed;
+}
+
+template<typename Policy>
+void FlowBoundaries::impose(ParticleStore<Policy>& store,
+                            std::vector<double>& acceleration_x,
+                            std::vector<double>& acceleration_y) const
+{
+    if (inflow_edges.empty())
+        return;
+
+    #pragma omp parallel for schedule(static)
+    for (long long n=0; n<(long long)store.size(); n++)
+    {
+        if (!store.active[n])
+            continue;
+        const std::array<double,2> point = store.position(n);
+        for (std::size_t k=0; k<inflow_edges.size(); k++)
+        {
+            const Edge& edge = inflow_edges[k];
+            double depth, along;
+            locate(edge, point[0], point[1], depth, along);
+            if (depth >= 0. && depth < range
+                && along >= 0. && along <= edge.length)
+            {
+                store.set_velocity(n, inflows[k].speed*edge.normal_x,
+                                   inflows[k].speed*edge.normal_y);
+                acceleration_x[n] = 0.;
+                acceleration_y[n] = 0.;
+            }
+        }
+    }
+}
+
+template std::size_t FlowBoundaries::exchange(
+    ParticleStore<DoublePolicy>& store, double dt,
+    std::vector<std::size_t>& inserted);
+template std::size_t FlowBoundaries::exchange(
+    ParticleStore<SinglePolicy>& store, double dt,
+    std::vector<std::size_t>& inserted);
+template std::size_t FlowBoundaries::exchange(
+    ParticleStore<CellRelativePolicy>& store, double dt,
+    std::vector<std::size_t>& inserted);
+template void FlowBoundaries::impose(ParticleStore<DoublePolicy>& store,
+    std::vector<double>& acceleration_x,
+    std::vector<double>& acceleration_y) const;
+template void FlowBoundaries::impose(ParticleStore<SinglePolicy>& store,
+    std::vector<double>& acceleration_x,
+    std::vector<double>& acceleration_y) const;
+template void FlowBoundaries::impose(ParticleStore<CellRelativePolicy>& store,
+    std::vector<double>& acceleration_x,
+    std::vector<double>& acceleration_y) const;
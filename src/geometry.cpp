@@ -30,11 +30,17 @@ denominator is the length of the line.
 */
 double distance_to_line_segment(const arma::vec& point,
                                 const Line_Segment& segment)
+{
+    return arma::norm(point - closest_point_on_line_segment(point, segment));
+}
+
+arma::vec closest_point_on_line_segment(const arma::vec& point,
+                                        const Line_Segment& segment)
 {
     const double length_squared =
         arma::dot(segment.end - segment.start, segment.end - segment.start);
     if (length_squared == 0.0)
-        return arma::norm(point-segment.start);
+        return segment.start;
 
     // Consider the line extending the segment, parameterized as v + t (w - v).
     // We find projection of point p onto the line.
@@ -43,10 +49,7 @@ double distance_to_line_segment(const arma::vec& point,
     const double dot_product =
         arma::dot(point - segment.start, segment.end - segment.start);
     const double t = std::max(0., std::min(1., dot_product/length_squared));
-    const arma::vec projection =
-        segment.start + t * (segment.end - segment.start);
-    
-    return arma::norm(point - projection);
+    return segment.start + t * (segment.end - segment.start);
 }
 
 
@@ -0,0 +1,914 @@
+// File: integrator.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the integrator.h header
+//
+
+#include "integrator.h"
+#include "kernel.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static int thread_count()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static int thread_id()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+PressureSolver parse_pressure_solver(const std::string& name)
+{
+    if (name == "eos")
+        return PressureSolver::equation_of_state;
+    else if (name == "iisph")
+        return PressureSolver::iisph;
+    else
+        throw std::invalid_argument("unknown pressure solver " + name);
+}
+
+double EquationOfState::pressure(double density) const
+{
+    return bulk_modulus / bulk_modulus_derivative
+        * (std::pow(density/rest_density, bulk_modulus_derivative) - 1.)
+        + background_pressure;
+}
+
+double EquationOfState::internal_energy(double density) const
+{
+    // With P = A((rho/rho0)^n - 1) + B the integral is
+    // A/(n-1) ((rho/rho0)^n/rho - 1/rho0) + (B-A)(1/rho0 - 1/rho)
+    const double n = bulk_modulus_derivative;
+    const double A = bulk_modulus / n;
+    const double B = background_pressure;
+    const double ratio = density/rest_density;
+    const double stiff = std::abs(n-1.) < 1e-12
+        ? A*std::log(ratio)/rest_density
+        : A/(n-1.) * (std::pow(ratio, n)/density - 1./rest_density);
+    return stiff + (B-A)*(1./rest_density - 1./density);
+}
+
+double EquationOfState::sound_speed() const
+{
+    return std::sqrt(bulk_modulus / rest_density);
+}
+
+template<typename Policy>
+void Integrator<Policy>::initialize(const std::vector<SPHParticle>& particles,
+                                    const StaticBoundary& _walls,
+                                    double xmin, double ymin)
+{
+    walls = &_walls;
+    max_range = 0.;
+    for (const SPHParticle& particle : particles)
+        max_range = std::max(max_range, particle.range);
+    for (double range : walls->range)
+        max_range = std::max(max_range, range);
+    if (max_range <= 0.)
+        throw std::invalid_argument("particle ranges must be positive");
+
+    fluid.load(particles, xmin, ymin, max_range);
+    boundary_mass.assign(walls->size(), 0.);
+
+    // Initial conditions may put particles on the far side of the box, or
+    // outside of it, along periodic axes. The grid bins by the wrapped cell,
+    // so the stored position has to be wrapped too for the separations to
+    // come out right.
+    if (periodicity.any())
+    {
+        #pragma omp parallel for schedule(static)
+        for (long long i=0; i<(long long)fluid.size(); i++)
+        {
+            const std::array<double,2> point = fluid.position(i);
+            fluid.set_position(i, periodicity.wrap_x(point[0]),
+                               periodicity.wrap_y(point[1]));
+        }
+    }
+
+    acceleration_x.clear();
+    acceleration_y.clear();
+    resize_work_arrays();
+    pair_buffers.resize(thread_count());
+
+    if (auto_tune)
+    {
+        tuner.start(tuning);
+        tuning = tuner.parameters();
+    }
+    steps = 0;
+    since_sort = 0;
+    grid.periodicity = periodicity;
+    rebuild_grid();
+
+    // Without a given rest density, the initial state of the fluid alone is
+    // taken to be at rest
+    if (eos.rest_density <= 0.)
+    {
+        eos.rest_density = 1.;
+        density_sweep();
+        eos.rest_density = mean_density();
+        if (eos.rest_density <= 0.)
+            throw std::invalid_argument("initial density is zero");
+    }
+
+    // The wall should look like fluid at rest density, whatever its
+    // spacing, so each boundary particle gets the mass of the volume it
+    // covers
+    for (std::size_t b=0; b<boundary_mass.size(); b++)
+        boundary_mass[b] = eos.rest_density * walls->volume[b];
+
+    // Inflow particles look like the average initial particle
+    if (!flow.empty())
+    {
+        double mean_mass = 0.;
+        double mean_range = 0.;
+        for (const SPHParticle& particle : particles)
+        {
+            mean_mass += particle.mass / particles.size();
+            mean_range += particle.range / particles.size();
+        }
+        flow.set_fluid(eos.rest_density, mean_mass, mean_range);
+    }
+
+    density_sweep();
+    if (solver == PressureSolver::iisph)
+    {
+        // The implicit solve starts from the pressure of the last step
+        std::fill(fluid.pressure.begin(), fluid.pressure.end(), 0.);
+    }
+    else
+        force_sweep(0.);
+    synchronized = true;
+}
+
+template<typename Policy>
+void Integrator<Policy>::step(double dt, bool synchronize)
+{
+    tuned = false;
+    if (auto_tune)
+        tuning = tuner.parameters();
+
+#ifdef _OPENMP
+    // The neighbor sweeps take their schedule from here
+    if (tuning.chunk_size > 0)
+        omp_set_schedule(omp_sched_dynamic, tuning.chunk_size);
+    else
+        omp_set_schedule(omp_sched_static, 0);
+#endif
+
+    if (!auto_tune)
+    {
+        advance(dt, synchronize);
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    advance(dt, synchronize);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    tuned = tuner.record(elapsed.count(), fluid.live(),
+                         grid.cells_x*grid.cell_size_x
+                         * grid.cells_y*grid.cell_size_y);
+}
+
+template<typename Policy>
+void Integrator<Policy>::advance(double dt, bool synchronize)
+{
+    last_dt = dt;
+    if (solver == PressureSolver::iisph)
+    {
+        implicit_step(dt);
+        synchronized = true;
+        return;
+    }
+
+    const long long count = fluid.size();
+
+    // Opening half kick, unless the last force sweep already applied it,
+    // followed by the drift
+    const double kick = synchronized ? 0.5*dt : 0.;
+    double speed_squared = 0.;
+    bool any_wrapped = false;
+    #pragma omp parallel for schedule(static) \
+        reduction(max:speed_squared) reduction(||:any_wrapped)
+    for (long long i=0; i<count; i++)
+    {
+        if (!fluid.active[i])
+            continue;
+        const std::array<double,2> velocity = fluid.velocity(i);
+        const double vx = velocity[0] + kick*acceleration_x[i];
+        const double vy = velocity[1] + kick*acceleration_y[i];
+        const std::array<double,2> point = fluid.position(i);
+        const double x = point[0] + dt*vx;
+        const double y = point[1] + dt*vy;
+        const double wrapped_x = periodicity.wrap_x(x);
+        const double wrapped_y = periodicity.wrap_y(y);
+        speed_squared = std::max(speed_squared, vx*vx + vy*vy);
+        any_wrapped = any_wrapped || wrapped_x != x || wrapped_y != y;
+        fluid.set_velocity(i, vx, vy);
+        fluid.set_position(i, wrapped_x, wrapped_y);
+    }
+    moved(dt, std::sqrt(speed_squared), any_wrapped);
+
+    update_particles(dt);
+    density_sweep();
+
+    // Close this step, and if the velocities aren't needed at the full step
+    // open the next one in the same pass
+    force_sweep(synchronize ? 0.5*dt : dt);
+    flow.impose(fluid, acceleration_x, acceleration_y);
+    synchronized = synchronize;
+}
+
+template<typename Policy>
+void Integrator<Policy>::store(std::vector<SPHParticle>& particles) const
+{
+    fluid.store(particles);
+}
+
+template<typename Policy>
+double Integrator<Policy>::mean_density() const
+{
+    double sum = 0.;
+    #pragma omp parallel for schedule(static) reduction(+:sum)
+    for (long long i=0; i<(long long)fluid.size(); i++)
+    {
+        if (fluid.active[i])
+            sum += fluid.density[i];
+    }
+    return fluid.live() > 0 ? sum / fluid.live() : 0.;
+}
+
+template<typename Policy>
+Observables Integrator<Policy>::observables() const
+{
+    double kinetic = 0.;
+    double potential = 0.;
+    double internal = 0.;
+    double momentum_x = 0.;
+    double momentum_y = 0.;
+    #pragma omp parallel for schedule(static) \
+        reduction(+:kinetic,potential,internal,momentum_x,momentum_y)
+    for (long long i=0; i<(long long)fluid.size(); i++)
+    {
+        if (!fluid.active[i])
+            continue;
+        const double mass = fluid.mass[i];
+        const std::array<double,2> velocity = fluid.velocity(i);
+        const double vx = velocity[0];
+        const double vy = velocity[1];
+        const std::array<double,2> point = fluid.position(i);
+        kinetic += 0.5*mass*(vx*vx + vy*vy);
+        potential -= mass*(gravity_x*point[0] + gravity_y*point[1]);
+        if (fluid.density[i] > 0.)
+            internal += mass*eos.internal_energy(fluid.density[i]);
+        momentum_x += mass*vx;
+        momentum_y += mass*vy;
+    }
+
+    Observables result;
+    result.kinetic_energy = kinetic;
+    result.potential_energy = potential;
+    result.internal_energy = internal;
+    result.momentum_x = momentum_x;
+    result.momentum_y = momentum_y;
+    return result;
+}
+
+template<typename Policy>
+void Integrator<Policy>::rebuild_grid()
+{
+    grid.build(fluid.size(),
+        [this](std::size_t n) { return fluid.position(n); },
+        tuning.cell_factor*search_radius(),
+        [this](std::size_t n) { return fluid.active[n] != 0; });
+    binned = tuning;
+    travel = 0.;
+    wrapped = false;
+    for (unsigned int n : unbinned)
+        is_unbinned[n] = 0;
+    unbinned.clear();
+    exchanged = false;
+}
+
+template<typename Policy>
+void Integrator<Policy>::moved(double dt, double max_speed, bool _wrapped)
+{
+    travel += dt*max_speed;
+    wrapped = wrapped || _wrapped;
+}
+
+// The grid already lists the live particles in cell order, which is the
+// order to put them in. Only the per particle state that lives across steps
+// needs to move.
+template<typename Policy>
+void Integrator<Policy>::reorder()
+{
+    rebuild_grid();
+    const std::vector<unsigned int> order = grid.sorted;
+    fluid.compact(order);
+    for (std::vector<double>* column : {&acceleration_x, &acceleration_y})
+    {
+        std::vector<double> reordered(order.size());
+        for (std::size_t k=0; k<order.size(); k++)
+            reordered[k] = (*column)[order[k]];
+        column->swap(reordered);
+    }
+    resize_work_arrays();
+    rebuild_grid();
+    since_sort = 0;
+    renumberings++;
+}
+
+// Work arrays follow the size of the store. New slots start without
+// acceleration.
+template<typename Policy>
+void Integrator<Policy>::resize_work_arrays()
+{
+    const std::size_t count = fluid.size();
+    acceleration_x.resize(count, 0.);
+    acceleration_y.resize(count, 0.);
+    next_vx.resize(count);
+    next_vy.resize(count);
+    is_unbinned.resize(count, 0);
+    pair_owner.resize(count);
+    pair_begin.resize(count);
+    pair_end.resize(count);
+    if (solver == PressureSolver::iisph)
+    {
+        displacement_x.resize(count);
+        displacement_y.resize(count);
+        diagonal.resize(count);
+        advected_density.resize(count);
+        neighbor_x.resize(count);
+        neighbor_y.resize(count);
+        next_pressure.resize(count);
+    }
+}
+
+template<typename Policy>
+void Integrator<Policy>::update_particles(double dt)
+{
+    inserted_slots.clear();
+    removed = flow.exchange(fluid, dt, inserted_slots);
+    inserted = inserted_slots.size();
+    resize_work_arrays();
+    for (std::size_t n : inserted_slots)
+    {
+        acceleration_x[n] = 0.;
+        acceleration_y[n] = 0.;
+        if (!is_unbinned[n])
+        {
+            is_unbinned[n] = 1;
+            unbinned.push_back(n);
+        }
+    }
+    exchanged = exchanged || inserted > 0 || removed > 0;
+
+    steps++;
+    since_sort++;
+    const bool compact_due = compact_interval > 0
+        && steps % compact_interval == 0 && fluid.live() < fluid.size();
+    const bool sort_due = tuning.sort_interval > 0
+        && since_sort >= tuning.sort_interval;
+    const bool sort_requested = auto_tune && tuner.sort_requested();
+    if (compact_due || sort_due || sort_requested)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        reorder();
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        if (sort_requested)
+            tuner.record_sort(elapsed.count());
+        return;
+    }
+
+    // The grid holds every particle within the range of a point as long as
+    // none has moved further than the skin, or across a seam, since it was
+    // binned. Particles that came in since are searched without it.
+    if (unbinned.size() > max_unbinned || wrapped
+        || travel > tuning.skin*max_range
+        || tuning.cell_factor != binned.cell_factor
+        || tuning.skin != binned.skin)
+        rebuild_grid();
+}
+
+template<typename Policy>
+template<typename Visit>
+void Integrator<Policy>::for_each_neighbor(std::size_t i, Visit visit) const
+{
+    const std::size_t count = fluid.size();
+    const std::array<double,2> point = fluid.position(i);
+    const double range_i = fluid.range[i];
+
+    // The separation is taken to the image of j, which is shifted away from
+    // j by whole periods
+    grid.for_each_image(point[0], point[1], search_radius(),
+        [&](unsigned int j, double shift_x, double shift_y)
+        {
+            if (exchanged && (!fluid.active[j] || is_unbinned[j]))
+                return;
+            const std::array<double,2> separation = fluid.separation(i, j);
+            const double separation_x = separation[0] - shift_x;
+            const double separation_y = separation[1] - shift_y;
+            const double range = 0.5*(range_i + fluid.range[j]);
+            const double distance_squared =
+                separation_x*separation_x + separation_y*separation_y;
+            if (distance_squared < range*range)
+                visit(j, separation_x, separation_y,
+                      std::sqrt(distance_squared), range);
+        });
+    for (unsigned int j : unbinned)
+    {
+        if (!fluid.active[j])
+            continue;
+        const std::array<double,2> separation = fluid.separation(i, j);
+        const double separation_x = periodicity.nearest_x(separation[0]);
+        const double separation_y = periodicity.nearest_y(separation[1]);
+        const double range = 0.5*(range_i + fluid.range[j]);
+        const double distance_squared =
+            separation_x*separation_x + separation_y*separation_y;
+        if (distance_squared < range*range)
+            visit(j, separation_x, separation_y,
+                  std::sqrt(distance_squared), range);
+    }
+
+    // Most of the fluid is too far from the walls to need the search
+    if (!walls->near(point[0], point[1]))
+        return;
+    walls->for_each_candidate(point[0], point[1],
+        [&](unsigned int b, double separation_x, double separation_y)
+        {
+            const double range = 0.5*(range_i + walls->range[b]);
+            const double distance_squared =
+                separation_x*separation_x + separation_y*separation_y;
+            if (distance_squared < range*range)
+                visit(count + b, separation_x, separation_y,
+                      std::sqrt(distance_squared), range);
+        });
+}
+
+template<typename Policy>
+template<typename Visit>
+void Integrator<Policy>::for_each_pair(std::size_t i, Visit visit) const
+{
+    if (cache_pairs)
+    {
+        const std::vector<Pair>& buffer = pair_buffers[pair_owner[i]];
+        for (std::size_t k=pair_begin[i]; k<pair_end[i]; k++)
+            visit(buffer[k].j, (double)buffer[k].separation_x,
+                  (double)buffer[k].separation_y, (double)buffer[k].gradient);
+        return;
+    }
+
+    for_each_neighbor(i, [&](unsigned int j, double separation_x,
+                             double separation_y, double distance,
+                             double range)
+    {
+        if (distance > 0.)
+            visit(j, separation_x, separation_y,
+                  derivative_cubic_sph_kernel_2d(distance/range)
+                  / (range*range*range*distance));
+    });
+}
+
+template<typename Policy>
+double Integrator<Policy>::artificial_viscosity(double approach,
+                                                double distance_squared,
+                                                double range,
+                                                double mean_density) const
+{
+    if (viscosity <= 0. || approach >= 0.)
+        return 0.;
+    const double mu = range*approach / (distance_squared + 0.01*range*range);
+    return -viscosity*eos.sound_speed()*mu / mean_density;
+}
+
+template<typename Policy>
+void Integrator<Policy>::density_sweep()
+{
+    const std::size_t count = fluid.size();
+    pairs = 0;
+
+    #pragma omp parallel
+    {
+        std::vector<Pair>& buffer = pair_buffers[thread_id()];
+        buffer.clear();
+        std::size_t found = 0;
+
+        #pragma omp for schedule(runtime)
+        for (long long i=0; i<(long long)count; i++)
+        {
+            if (!fluid.active[i])
+            {
+                pair_begin[i] = pair_end[i] = 0;
+                continue;
+            }
+            const std::size_t begin = buffer.size();
+            double density = 0.;
+
+            for_each_neighbor(i, [&](unsigned int j, double separation_x,
+                                     double separation_y, double distance,
+                                     double range)
+            {
+                const double mass = (j < count) ? (double)fluid.mass[j]
+                                                : boundary_mass[j-count];
+                const double q = distance / range;
+                density += mass * cubic_sph_kernel_2d(q) / (range*range);
+                found++;
+
+                if (cache_pairs && distance > 0.)
+                {
+                    buffer.push_back({j, (real)separation_x,
+                        (real)separation_y,
+                        (real)(derivative_cubic_sph_kernel_2d(q)
+                               / (range*range*range*distance))});
+                }
+            });
+
+            pair_owner[i] = thread_id();
+            pair_begin[i] = begin;
+            pair_end[i] = buffer.size();
+
+            // The density of i is complete, so its pressure can be set
+            // without another pass, unless it is solved for
+            fluid.density[i] = density;
+            if (solver == PressureSolver::equation_of_state)
+                fluid.pressure[i] = eos.pressure(density);
+        }
+
+        #pragma omp atomic
+        pairs += found;
+    }
+}
+
+template<typename Policy>
+void Integrator<Policy>::force_sweep(double kick)
+{
+    const std::size_t count = fluid.size();
+
+    #pragma omp parallel for schedule(runtime)
+    for (long long i=0; i<(long long)count; i++)
+    {
+        if (!fluid.active[i])
+            continue;
+        const double density_i = fluid.density[i];
+        const double pressure_term_i = fluid.pressure[i]/(density_i*density_i);
+        const std::array<double,2> velocity_i = fluid.velocity(i);
+        const double vx_i = velocity_i[0];
+        const double vy_i = velocity_i[1];
+        double ax = gravity_x;
+        double ay = gravity_y;
+
+        for_each_pair(i, [&](unsigned int j, double separation_x,
+                             double separation_y, double gradient)
+        {
+            double mass, pressure_term, density_j, vx_j, vy_j, range;
+            if (j < count)
+            {
+                mass = fluid.mass[j];
+                density_j = fluid.density[j];
+                pressure_term = fluid.pressure[j]/(density_j*density_j);
+                vx_j = fluid.vx[j];
+                vy_j = fluid.vy[j];
+                range = 0.5*(fluid.range[i] + fluid.range[j]);
+            }
+            else
+            {
+                // Boundary particles mirror the pressure of the fluid
+                // particle, and are at rest
+                mass = boundary_mass[j-count];
+                density_j = density_i;
+                pressure_term = pressure_term_i;
+                vx_j = vy_j = 0.;
+                range = 0.5*(fluid.range[i] + walls->range[j-count]);
+            }
+
+            const double viscous_term = artificial_viscosity(
+                (vx_i-vx_j)*separation_x + (vy_i-vy_j)*separation_y,
+                separation_x*separation_x + separation_y*separation_y,
+                range, 0.5*(density_i + density_j));
+
+            const double coefficient =
+                -mass*(pressure_term_i + pressure_term + viscous_term)
+                * gradient;
+            ax += coefficient*separation_x;
+            ay += coefficient*separation_y;
+        });
+
+        acceleration_x[i] = ax;
+        acceleration_y[i] = ay;
+        next_vx[i] = vx_i + kick*ax;
+        next_vy[i] = vy_i + kick*ay;
+    }
+
+    fluid.swap_velocities(next_vx, next_vy);
+}
+
+// One IISPH step. The notation follows Ihmsen et al. 2014, with d_ii the
+// displacement of i per unit of its own pressure and a_ii the diagonal of
+// the system, both with the dt^2 included.
+template<typename Policy>
+void Integrator<Policy>::implicit_step(double dt)
+{
+    update_particles(dt);
+    const long long count = fluid.size();
+    density_sweep();
+    implicit_setup(dt);
+
+    // Warm start from the last step's pressure
+    #pragma omp parallel for schedule(static)
+    for (long long i=0; i<count; i++)
+        fluid.pressure[i] *= 0.5;
+
+    solver_iterations = 0;
+    solver_error = 0.;
+    while (solver_iterations < solver_max_iterations)
+    {
+        solver_error = implicit_iteration(dt);
+        solver_iterations++;
+        if (solver_iterations >= 2 && solver_error < solver_tolerance)
+            break;
+    }
+
+    // Kick the advected velocity with the pressure force, and drift
+    #pragma omp parallel for schedule(runtime)
+    for (long long i=0; i<count; i++)
+    {
+        if (!fluid.active[i])
+            continue;
+        const double density_i = fluid.density[i];
+        const double pressure_term_i = fluid.pressure[i]/(density_i*density_i);
+        double ax = 0.;
+        double ay = 0.;
+
+        for_each_pair(i, [&](unsigned int j, double separation_x,
+                             double separation_y, double gradient)
+        {
+            double coefficient;
+            if (j < (unsigned int)count)
+            {
+                const double density_j = fluid.density[j];
+                coefficient = -fluid.mass[j]*(pressure_term_i
+                    + fluid.pressure[j]/(density_j*density_j))*gradient;
+            }
+            else
+                coefficient = -boundary_mass[j-count]*pressure_term_i
+                              *gradient;
+            ax += coefficient*separation_x;
+            ay += coefficient*separation_y;
+        });
+
+        const double vx = next_vx[i] + dt*ax;
+        const double vy = next_vy[i] + dt*ay;
+        const std::array<double,2> velocity = fluid.velocity(i);
+        acceleration_x[i] = (vx - velocity[0])/dt;
+        acceleration_y[i] = (vy - velocity[1])/dt;
+        next_vx[i] = vx;
+        next_vy[i] = vy;
+    }
+
+    fluid.swap_velocities(next_vx, next_vy);
+    flow.impose(fluid, acceleration_x, acceleration_y);
+
+    double speed_squared = 0.;
+    bool any_wrapped = false;
+    #pragma omp parallel for schedule(static) \
+        reduction(max:speed_squared) reduction(||:any_wrapped)
+    for (long long i=0; i<count; i++)
+    {
+        if (!fluid.active[i])
+            continue;
+        const std::array<double,2> velocity = fluid.velocity(i);
+        const double vx = velocity[0];
+        const double vy = velocity[1];
+        const std::array<double,2> point = fluid.position(i);
+        const double x = point[0] + dt*vx;
+        const double y = point[1] + dt*vy;
+        const double wrapped_x = periodicity.wrap_x(x);
+        const double wrapped_y = periodicity.wrap_y(y);
+        speed_squared = std::max(speed_squared, vx*vx + vy*vy);
+        any_wrapped = any_wrapped || wrapped_x != x || wrapped_y != y;
+        fluid.set_position(i, wrapped_x, wrapped_y);
+    }
+    moved(dt, std::sqrt(speed_squared), any_wrapped);
+}
+
+// Everything in the pressure system that doesn't depend on the pressure
+template<typename Policy>
+void Integrator<Policy>::implicit_setup(double dt)
+{
+    const std::size_t count = fluid.size();
+    const double dt2 = dt*dt;
+
+    // Velocities after the forces other than pressure go into next_vx and
+    // next_vy, and d_ii and a_ii only need the density of i
+    #pragma omp parallel for schedule(runtime)
+    for (long long i=0; i<(long long)count; i++)
+    {
+        if (!fluid.active[i])
+            continue;
+        const double density_i = fluid.density[i];
+        const std::array<double,2> velocity_i = fluid.velocity(i);
+        const double vx_i = velocity_i[0];
+        const double vy_i = velocity_i[1];
+        double ax = gravity_x;
+        double ay = gravity_y;
+        double dx = 0.;
+        double dy = 0.;
+
+        for_each_pair(i, [&](unsigned int j, double separation_x,
+                             double separation_y, double gradient)
+        {
+            double mass, density_j, vx_j, vy_j, range;
+            if (j < count)
+            {
+                mass = fluid.mass[j];
+                density_j = fluid.density[j];
+                vx_j = fluid.vx[j];
+                vy_j = fluid.vy[j];
+                range = 0.5*(fluid.range[i] + fluid.range[j]);
+            }
+            else
+            {
+                mass = boundary_mass[j-count];
+                density_j = density_i;
+                vx_j = vy_j = 0.;
+                range = 0.5*(fluid.range[i] + walls->range[j-count]);
+            }
+
+            const double coefficient = -mass*gradient*artificial_viscosity(
+                (vx_i-vx_j)*separation_x + (vy_i-vy_j)*separation_y,
+                separation_x*separation_x + separation_y*separation_y,
+                range, 0.5*(density_i + density_j));
+            ax += coefficient*separation_x;
+            ay += coefficient*separation_y;
+            dx -= mass*gradient*separation_x;
+            dy -= mass*gradient*separation_y;
+        });
+
+        next_vx[i] = vx_i + dt*ax;
+        next_vy[i] = vy_i + dt*ay;
+        displacement_x[i] = dt2*dx/(density_i*density_i);
+        displacement_y[i] = dt2*dy/(density_i*density_i);
+
+        // a_ii = sum_j m_j (d_ii - d_ji) . grad W_ij, where d_ji is the
+        // displacement of j by the pressure of i. The walls have no d_ji.
+        const double mass_i = fluid.mass[i];
+        double sum = 0.;
+        for_each_pair(i, [&](unsigned int j, double separation_x,
+                             double separation_y, double gradient)
+        {
+            double mass = (j < count) ? (double)fluid.mass[j]
+                                      : boundary_mass[j-count];
+            double across_x = displacement_x[i];
+            double across_y = displacement_y[i];
+            if (j < count)
+            {
+                const double scale = dt2*mass_i/(density_i*density_i)
+                                     *gradient;
+                across_x -= scale*separation_x;
+                across_y -= scale*separation_y;
+            }
+            sum += mass*gradient*(across_x*separation_x
+                                  + across_y*separation_y);
+        });
+        diagonal[i] = sum;
+    }
+
+    // Density after the advection velocities, which need every particle's
+    // velocity from above
+    #pragma omp parallel for schedule(runtime)
+    for (long long i=0; i<(long long)count; i++)
+    {
+        if (!fluid.active[i])
+            continue;
+        const double vx_i = next_vx[i];
+        const double vy_i = next_vy[i];
+        double change = 0.;
+        for_each_pair(i, [&](unsigned int j, double separation_x,
+                             double separation_y, double gradient)
+        {
+            double mass, vx_j, vy_j;
+            if (j < count)
+            {
+                mass = fluid.mass[j];
+                vx_j = next_vx[j];
+                vy_j = next_vy[j];
+            }
+            else
+            {
+                mass = boundary_mass[j-count];
+                vx_j = vy_j = 0.;
+            }
+            change += mass*gradient*((vx_i-vx_j)*separation_x
+                                     + (vy_i-vy_j)*separation_y);
+        });
+        advected_density[i] = fluid.density[i] + dt*change;
+    }
+}
+
+// One relaxed Jacobi iteration of the pressure, returning the mean density
+// error of the pressures it started from, relative to the rest density
+template<typename Policy>
+double Integrator<Policy>::implicit_iteration(double dt)
+{
+    const std::size_t count = fluid.size();
+    const double dt2 = dt*dt;
+    const double rest_density = eos.rest_density;
+
+    // sum_j d_ij p_j, the displacement of i by the pressure of the fluid
+    #pragma omp parallel for schedule(runtime)
+    for (long long i=0; i<(long long)count; i++)
+    {
+        if (!fluid.active[i])
+            continue;
+        double sum_x = 0.;
+        double sum_y = 0.;
+        for_each_pair(i, [&](unsigned int j, double separation_x,
+                             double separation_y, double gradient)
+        {
+            if (j >= count)
+                return;
+            const double density_j = fluid.density[j];
+            const double scale = -dt2*fluid.mass[j]*fluid.pressure[j]
+                                 /(density_j*density_j)*gradient;
+            sum_x += scale*separation_x;
+            sum_y += scale*separation_y;
+        });
+        neighbor_x[i] = sum_x;
+        neighbor_y[i] = sum_y;
+    }
+
+    double error = 0.;
+    #pragma omp parallel for schedule(runtime) reduction(+:error)
+    for (long long i=0; i<(long long)count; i++)
+    {
+        if (!fluid.active[i])
+            continue;
+        const double density_i = fluid.density[i];
+        const double pressure_i = fluid.pressure[i];
+        const double mass_i = fluid.mass[i];
+
+        // The density change from every pressure but p_i, which is the
+        // off diagonal part of row i
+        double off_diagonal = 0.;
+        for_each_pair(i, [&](unsigned int j, double separation_x,
+                             double separation_y, double gradient)
+        {
+            double across_x = neighbor_x[i];
+            double across_y = neighbor_y[i];
+            double mass;
+            if (j < count)
+            {
+                // Take away d_jj p_j and d_ji p_i from the displacement of
+                // j, leaving the part from its other neighbors
+                mass = fluid.mass[j];
+                const double scale = dt2*mass_i/(density_i*density_i)
+                                     *gradient*pressure_i;
+                across_x -= displacement_x[j]*fluid.pressure[j]
+                            + neighbor_x[j] - scale*separation_x;
+                across_y -= displacement_y[j]*fluid.pressure[j]
+                            + neighbor_y[j] - scale*separation_y;
+            }
+            else
+                mass = boundary_mass[j-count];
+            off_diagonal += mass*gradient*(across_x*separation_x
+                                           + across_y*separation_y);
+        });
+
+        // Only compression is an error, since the pressure can't pull
+        const double predicted = advected_density[i]
+                                 + diagonal[i]*pressure_i + off_diagonal;
+        error += std::max(0., predicted - rest_density);
+
+        double pressure = 0.;
+        if (std::abs(diagonal[i]) > 1e-30)
+            pressure = (1.-solver_relaxation)*pressure_i
+                + solver_relaxation*(rest_density - advected_density[i]
+                                     - off_diagonal)/diagonal[i];
+        next_pressure[i] = std::max(0., pressure);
+    }
+
+    std::swap(fluid.pressure, next_pressure);
+    return fluid.live() > 0 ? error / (fluid.live()*rest_density) : 0.;
+}
+
+template class Integrator<DoublePolicy>;
+template class Integrator<SinglePolicy>;
+template class Integrator<CellRelativePolicy>;
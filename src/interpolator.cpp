@@ -0,0 +1,150 @@
+// File: interpolator.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the interpolator.h header
+//
+
+#include "interpolator.h"
+#include <cmath>
+
+std::vector<unsigned int> Interpolator::cell_order(
+    const Grid& grid, const std::vector<std::array<double,2>>& points)
+{
+    const std::size_t count = points.size();
+    std::vector<unsigned int> cell(count);
+    for (std::size_t q=0; q<count; q++)
+        cell[q] = grid.cell_x(points[q][0])*grid.cells_y
+                  + grid.cell_y(points[q][1]);
+    std::vector<unsigned int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+        [&cell](unsigned int a, unsigned int b) { return cell[a] < cell[b]; });
+    return order;
+}
+
+template<typename Policy>
+void Interpolator::density(const Integrator<Policy>& integrator,
+                           const std::vector<std::array<double,2>>& points,
+                           std::vector<double>& values,
+                           std::vector<double>* gradients) const
+{
+    const ParticleStore<Policy>& fluid = integrator.particles();
+    const StaticBoundary& walls = integrator.boundary();
+    const std::size_t fluid_count = fluid.size();
+    const double rest_density = integrator.eos.rest_density;
+
+    const std::size_t count = points.size();
+    values.assign(count, 0.);
+    if (gradients != nullptr)
+        gradients->assign(count*2, 0.);
+    const Grid& index = integrator.neighbor_grid();
+    if (index.cells_x == 0 || index.cells_y == 0)
+        return;
+    const std::vector<unsigned int> order = cell_order(index, points);
+
+    #pragma omp parallel for schedule(static)
+    for (long long k=0; k<(long long)count; k++)
+    {
+        const unsigned int q = order[k];
+
+        // Sums of m W and V W, and of their gradients
+        double mass_sum = 0.;
+        double mass_x = 0.;
+        double mass_y = 0.;
+        double volume_sum = 0.;
+        double volume_x = 0.;
+        double volume_y = 0.;
+
+        integrator.for_each_point_neighbor(points[q][0], points[q][1],
+            [&](unsigned int j, double separation_x, double separation_y,
+                double distance, double h)
+            {
+                double mass, volume;
+                if (j >= fluid_count)
+                {
+                    volume = walls.volume[j-fluid_count];
+                    mass = rest_density*volume;
+                }
+                else
+                {
+                    if (fluid.density[j] <= 0.)
+                        return;
+                    mass = fluid.mass[j];
+                    volume = mass/fluid.density[j];
+                }
+                const double w = cubic_sph_kernel_2d(distance/h)/(h*h);
+                double dw = 0.;
+                if (distance > 0.)
+                    dw = derivative_cubic_sph_kernel_2d(distance/h)
+                         /(h*h*h*distance);
+                mass_sum += mass*w;
+                mass_x += mass*dw*separation_x;
+                mass_y += mass*dw*separation_y;
+                volume_sum += volume*w;
+                volume_x += volume*dw*separation_x;
+                volume_y += volume*dw*separation_y;
+            });
+
+        if (shepard)
+        {
+            // Quotient rule for the normalized sum
+            if (volume_sum > 0.)
+            {
+                mass_sum /= volume_sum;
+                mass_x = (mass_x - mass_sum*volume_x)/volume_sum;
+                mass_y = (mass_y - mass_sum*volume_y)/volume_sum;
+            }
+            else
+                mass_sum = mass_x = mass_y = 0.;
+        }
+        values[q] = mass_sum;
+        if (gradients != nullptr)
+        {
+            (*gradients)[q*2] = mass_x;
+            (*gradients)[q*2 + 1] = mass_y;
+        }
+    }
+}
+
+template<typename Policy>
+void Interpolator::probe(const Integrator<Policy>& integrator,
+                         const std::vector<std::array<double,2>>& points,
+                         std::vector<double>& values) const
+{
+    const ParticleStore<Policy>& fluid = integrator.particles();
+    std::vector<double> densities, fields;
+    density(integrator, points, densities);
+    interpolate(integrator,
+        [&](std::size_t j, double* a)
+        {
+            const std::array<double,2> velocity = integrator.velocity(j);
+            a[0] = fluid.pressure[j];
+            a[1] = velocity[0];
+            a[2] = velocity[1];
+        },
+        3, points, fields);
+
+    values.resize(points.size()*4);
+    for (std::size_t q=0; q<points.size(); q++)
+    {
+        values[q*4] = densities[q];
+        for (int c=0; c<3; c++)
+            values[q*4 + 1 + c] = fields[q*3 + c];
+    }
+}
+
+template void Interpolator::density(const Integrator<DoublePolicy>&,
+    const std::vector<std::array<double,2>>&, std::vector<double>&,
+    std::vector<double>*) const;
+template void Interpolator::density(const Integrator<SinglePolicy>&,
+    const std::vector<std::array<double,2>>&, std::vector<double>&,
+    std::vector<double>*) const;
+template void Interpolator::density(const Integrator<CellRelativePolicy>&,
+    const std::vector<std::array<double,2>>&, std::vector<double>&,
+    std::vector<double>*) const;
+template void Interpolator::probe(const Integrator<DoublePolicy>&,
+    const std::vector<std::array<double,2>>&, std::vector<double>&) const;
+template void Interpolator::probe(const Integrator<SinglePolicy>&,
+    const std::vector<std::array<double,2>>&, std::vector<double>&) const;
+template void Interpolator::probe(const Integrator<CellRelativePolicy>&,
+    const std::vector<std::array<double,2>>&, std::vector<double>&) const;
@@ -16,19 +16,21 @@
 // SPH
 
 // q is the scaled distance. q=1 is the range of influence.
+// The kernels are normalized for unit range, so they need to be divided by
+// range^dimension to be used for interpolation.
 double cubic_sph_kernel_2d(double q)
 {
-    if (0. <= q <= 0.5)
-        return 10. / (3.*PI) * (1. - 6. * (q*q - q*q*q));
+    if (0. <= q && q <= 0.5)
+        return 40. / (7.*PI) * (1. - 6. * (q*q - q*q*q));
     else if (q <= 1.)
-        return 20. / (3.*PI) * (1. - q) * (1. - q) * (1. - q);
+        return 80. / (7.*PI) * (1. - q) * (1. - q) * (1. - q);
     else
         return 0.;
 }
 
 double cubic_sph_kernel_3d(double q)
 {
-    if (0. <= q <= 0.5)
+    if (0. <= q && q <= 0.5)
         return 8. / PI * (1. - 6. * (q*q - q*q*q));
     else if (q <= 1.)
         return 16. / PI * (1. - q) * (1. - q) * (1. - q);
@@ -36,14 +38,21 @@ double cubic_sph_kernel_3d(double q)
         return 0.;
 }
 
-arma::vec gradient_cubic_sph_kernel_2d(double q, arma::vec q_hat)
+// dW/dq, which is what the neighbor loops need, so that they don't have
+// to build a vector for every pair
+double derivative_cubic_sph_kernel_2d(double q)
 {
-    if (0. <= q <= 0.5)
-        return 8./PI * (-12.*q*q + 18.*q*q*q) * q_hat;
+    if (0. <= q && q <= 0.5)
+        return 40. / (7.*PI) * (-12.*q + 18.*q*q);
     else if (q <= 1.)
-        return -48./PI * (1.-q)*(1.-q) * q_hat;
+        return -240. / (7.*PI) * (1.-q)*(1.-q);
     else
-        return 0.*q_hat;
+        return 0.;
+}
+
+arma::vec gradient_cubic_sph_kernel_2d(double q, arma::vec q_hat)
+{
+    return derivative_cubic_sph_kernel_2d(q) * q_hat;
 }
 
 /*
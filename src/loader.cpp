@@ -0,0 +1,153 @@
+// File: loader.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the loader.h header
+//
+
+#include "loader.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("could not open " + path);
+
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("could not stat " + path);
+    }
+    length = status.st_size;
+    if (length == 0)
+    {
+        close(fd);
+        throw std::invalid_argument(path + " is empty");
+    }
+
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        close(fd);
+        throw std::runtime_error("could not map " + path);
+    }
+    // The whole file is read front to back, so let the kernel read ahead
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    madvise(mapping, length, MADV_WILLNEED);
+    bytes = static_cast<const unsigned char*>(mapping);
+}
+
+MappedFile::~MappedFile()
+{
+    if (bytes != nullptr)
+        munmap(const_cast<unsigned char*>(bytes), length);
+    if (fd >= 0)
+        close(fd);
+}
+
+// Check the header against the expected magic, and return the element count
+static std::uint64_t read_header(const MappedFile& file, const char* magic,
+                                 const std::string& path)
+{
+    if (file.size() < sizeof(BinaryHeader))
+        throw std::invalid_argument(path + " is too short for a header");
+
+    BinaryHeader header;
+    std::memcpy(&header, file.data(), sizeof(BinaryHeader));
+    if (std::memcmp(header.magic, magic, 4) != 0)
+        throw std::invalid_argument(path + " has the wrong magic number");
+    if (header.version != 1)
+        throw std::invalid_argument(path + " has unsupported version "
+                                    + std::to_string(header.version));
+    return header.count;
+}
+
+Polygon load_vertices(const std::string& path)
+{
+    MappedFile file(path);
+    std::uint64_t count = read_header(file, "SPHV", path);
+
+    if (count < 3)
+        throw std::invalid_argument(path + " has fewer than 3 vertices");
+    if (file.size() != sizeof(BinaryHeader) + 2*count*sizeof(double))
+        throw std::invalid_argument(path + " size does not match its header");
+
+    const double* xy =
+        reinterpret_cast<const double*>(file.data() + sizeof(BinaryHeader));
+
+    Polygon domain;
+    domain.vertices.reserve(count);
+    for (std::uint64_t i=0; i<count; i++)
+    {
+        if (!std::isfinite(xy[2*i]) || !std::isfinite(xy[2*i+1]))
+            throw std::invalid_argument(path + " vertex "
+                                        + std::to_string(i) + " is not finite");
+        domain.vertices.push_back(arma::vec({xy[2*i], xy[2*i+1]}));
+    }
+
+    return domain;
+}
+
+void load_particles(const std::string& path, const Polygon& domain,
+                    std::vector<SPHParticle>& particles,
+                    const Periodicity& periodicity)
+{
+    MappedFile file(path);
+    std::uint64_t count = read_header(file, "SPHP", path);
+
+    if (file.size() != sizeof(BinaryHeader) + 6*count*sizeof(double))
+        throw std::invalid_argument(path + " size does not match its header");
+
+    // The header is 16 bytes, so every column stays 8 byte aligned
+    const double* columns =
+        reinterpret_cast<const double*>(file.data() + sizeof(BinaryHeader));
+    const double* x = columns;
+    const double* y = columns + count;
+    const double* vx = columns + 2*count;
+    const double* vy = columns + 3*count;
+    const double* mass = columns + 4*count;
+    const double* range = columns + 5*count;
+
+    particles.resize(count);
+
+    // Validation is folded into the copy so the file is only read once
+    long long invalid = 0;
+    long long outside = 0;
+    #pragma omp parallel for schedule(static) reduction(+:invalid,outside)
+    for (long long i=0; i<(long long)count; i++)
+    {
+        if (!std::isfinite(x[i]) || !std::isfinite(y[i])
+            || !std::isfinite(vx[i]) || !std::isfinite(vy[i])
+            || !(mass[i] > 0.) || !(range[i] > 0.)
+            || !std::isfinite(mass[i]) || !std::isfinite(range[i]))
+        {
+            invalid++;
+            continue;
+        }
+
+        SPHParticle& particle = particles[i];
+        particle.position = {periodicity.wrap_x(x[i]),
+                             periodicity.wrap_y(y[i])};
+        particle.velocity = {vx[i], vy[i]};
+        particle.mass = mass[i];
+        particle.range = range[i];
+        particle.pressure = 0.;
+
+        if (!point_inside_polygon(particle.position, domain))
+            outside++;
+    }
+
+    if (invalid > 0)
+        throw std::invalid_argument(path + " has " + std::to_string(invalid)
+            + " particles with non finite values or non positive mass/range");
+    if (outside > 0)
+        throw std::invalid_argument(path + " has " + std::to_string(outside)
+            + " particles outside of the domain");
+}
@@ -2,6 +2,7 @@
 //
 
 #include "../include/simulation.h"
+#include "../include/ensemble.h"
 #include <iostream>
 #include <fstream>
 
@@ -14,9 +15,18 @@ void easy_print(std::ostream& out, Args&&... args)
 }
 
 
-int main()
+// With an ensemble specification as the argument, run every member of the
+// ensemble instead of the single simulation in input.txt
+int main(int argc, char* argv[])
 {
+    if (argc > 1)
+    {
+        Ensemble ensemble(argv[1]);
+        return ensemble.run() == 0 ? 0 : 1;
+    }
+
     Simulation SPHsim;
+    SPHsim.run();
     SPHsim.sample_density(1000,1000);
 
     return 0;
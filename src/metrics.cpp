@@ -0,0 +1,191 @@
+// File: metrics.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the metrics.h header
+//
+
+#include "metrics.h"
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using Word = std::atomic<std::uint64_t>;
+static_assert(Word::is_always_lock_free,
+              "the metrics ring needs lock free 64 bit atomics");
+static_assert(sizeof(Word) == 8, "atomic words must match the layout");
+
+struct MetricsHeader
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t capacity;
+    std::uint32_t record_size;
+    Word head;
+    std::atomic<std::uint32_t> state;
+    std::uint32_t pid;
+    std::uint8_t reserved[32];
+};
+static_assert(sizeof(MetricsHeader) == 64,
+              "metrics header must be 64 bytes");
+
+// The payload is stored through atomics as well, so a reader racing the
+// writer reads stale or torn values instead of causing undefined behavior.
+// The sequence number tells it which.
+static const int payload_words = 12;
+struct MetricsRecord
+{
+    Word sequence;
+    Word payload[payload_words];
+};
+static_assert(sizeof(MetricsRecord) == 104,
+              "metrics record must be 104 bytes");
+
+static const std::uint32_t running = 1;
+static const std::uint32_t finished = 2;
+
+static std::uint64_t bits(double value)
+{
+    std::uint64_t word;
+    std::memcpy(&word, &value, sizeof(word));
+    return word;
+}
+
+// The process that is still writing to an existing segment, or 0 if the
+// segment was left behind by one that is gone or isn't a metrics ring
+static pid_t writer(int descriptor)
+{
+    struct stat status;
+    if (fstat(descriptor, &status) != 0
+        || status.st_size < (off_t)sizeof(MetricsHeader))
+        return 0;
+    void* mapping = mmap(nullptr, sizeof(MetricsHeader), PROT_READ,
+                         MAP_SHARED, descriptor, 0);
+    if (mapping == MAP_FAILED)
+        return 0;
+    const MetricsHeader* header = static_cast<MetricsHeader*>(mapping);
+    pid_t pid = 0;
+    if (std::memcmp(header->magic, "SPHM", 4) == 0
+        && header->state.load(std::memory_order_acquire) == running)
+        pid = header->pid;
+    munmap(mapping, sizeof(MetricsHeader));
+
+    // A process we may not signal still exists
+    if (pid > 0 && (kill(pid, 0) == 0 || errno == EPERM))
+        return pid;
+    return 0;
+}
+
+MetricsRing::~MetricsRing()
+{
+    close();
+}
+
+void MetricsRing::open(const std::string& _name, unsigned int capacity)
+{
+    close();
+    if (capacity == 0)
+        throw std::invalid_argument("metrics ring needs a capacity");
+    name = (!_name.empty() && _name[0] == '/') ? _name : "/" + _name;
+    size = sizeof(MetricsHeader) + capacity*sizeof(MetricsRecord);
+
+    // Only a segment whose writer is gone may be taken over, otherwise two
+    // simulations would write over each other's records
+    int descriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (descriptor < 0 && errno == EEXIST)
+    {
+        descriptor = shm_open(name.c_str(), O_RDWR, 0644);
+        const pid_t pid = descriptor < 0 ? 0 : writer(descriptor);
+        if (pid != 0)
+        {
+            ::close(descriptor);
+            throw std::runtime_error("shared memory " + name
+                                     + " is in use by process "
+                                     + std::to_string(pid));
+        }
+    }
+    if (descriptor < 0)
+        throw std::runtime_error("could not open shared memory " + name);
+    if (ftruncate(descriptor, size) != 0)
+    {
+        ::close(descriptor);
+        throw std::runtime_error("could not size shared memory " + name);
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         descriptor, 0);
+    ::close(descriptor);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("could not map shared memory " + name);
+    segment = mapping;
+
+    // A stale segment may hold old records, so everything is cleared before
+    // the magic marks the header valid
+    std::memset(segment, 0, size);
+    MetricsHeader* header = new (segment) MetricsHeader;
+    header->version = 2;
+    header->capacity = capacity;
+    header->record_size = sizeof(MetricsRecord);
+    header->head.store(0, std::memory_order_relaxed);
+    header->state.store(running, std::memory_order_relaxed);
+    header->pid = getpid();
+    MetricsRecord* records = reinterpret_cast<MetricsRecord*>(header + 1);
+    for (unsigned int k=0; k<capacity; k++)
+        new (&records[k]) MetricsRecord;
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, "SPHM", 4);
+}
+
+void MetricsRing::publish(const Metrics& metrics)
+{
+    if (segment == nullptr)
+        return;
+    MetricsHeader* header = static_cast<MetricsHeader*>(segment);
+    MetricsRecord* records = reinterpret_cast<MetricsRecord*>(header + 1);
+    const std::uint64_t n = header->head.load(std::memory_order_relaxed);
+    MetricsRecord& record = records[n % header->capacity];
+
+    const std::uint64_t payload[payload_words] = {
+        metrics.step, metrics.particles, bits(metrics.time), bits(metrics.dt),
+        bits(metrics.steps_per_second), bits(metrics.pairs_per_second),
+        bits(metrics.kinetic_energy), bits(metrics.potential_energy),
+        bits(metrics.internal_energy), bits(metrics.momentum_x),
+        bits(metrics.momentum_y),
+        metrics.resident_bytes};
+
+    // Sequence lock write: odd before the payload, even after it
+    record.sequence.store(2*n+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int k=0; k<payload_words; k++)
+        record.payload[k].store(payload[k], std::memory_order_relaxed);
+    record.sequence.store(2*n+2, std::memory_order_release);
+    header->head.store(n+1, std::memory_order_release);
+}
+
+void MetricsRing::close()
+{
+    if (segment == nullptr)
+        return;
+    MetricsHeader* header = static_cast<MetricsHeader*>(segment);
+    header->state.store(finished, std::memory_order_release);
+    munmap(segment, size);
+    shm_unlink(name.c_str());
+    segment = nullptr;
+}
+
+std::uint64_t MetricsRing::resident_bytes()
+{
+    // The second field of statm is the resident set in pages
+    std::ifstream statm("/proc/self/statm");
+    std::uint64_t pages = 0;
+    std::uint64_t resident = 0;
+    if (!(statm >> pages >> resident))
+        return 0;
+    return resident*sysconf(_SC_PAGESIZE);
+}
@@ -0,0 +1,405 @@
+// File: precision.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the precision.h header
+//
+
+#include "precision.h"
+#include "kernel.h"
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+Precision parse_precision(const std::string& name)
+{
+    if (name == "double")
+        return Precision::double_precision;
+    else if (name == "float")
+        return Precision::single_precision;
+    else if (name == "cell_relative")
+        return Precision::cell_relative;
+    else
+        throw std::invalid_argument("unknown precision " + name);
+}
+
+std::string precision_name(Precision precision)
+{
+    switch (precision)
+    {
+        case Precision::double_precision: return "double";
+        case Precision::single_precision: return "float";
+        case Precision::cell_relative: return "cell_relative";
+    }
+    return "";
+}
+
+template<typename Policy>
+void ParticleStore<Policy>::load(const std::vector<SPHParticle>& particles,
+                                 double _xmin, double _ymin,
+                                 double _anchor_size)
+{
+    xmin = _xmin;
+    ymin = _ymin;
+    anchor_size = _anchor_size;
+
+    const std::size_t count = particles.size();
+    x.resize(count);
+    y.resize(count);
+    if constexpr (Policy::cell_relative)
+    {
+        anchor_x.resize(count);
+        anchor_y.resize(count);
+    }
+    vx.resize(count);
+    vy.resize(count);
+    if constexpr (reduced)
+    {
+        exact_x.resize(count);
+        exact_y.resize(count);
+        exact_vx.resize(count);
+        exact_vy.resize(count);
+    }
+    mass.resize(count);
+    range.resize(count);
+    density.assign(count, 0.);
+    pressure.resize(count);
+    active.assign(count, 1);
+    free_slots.clear();
+
+    #pragma omp parallel for schedule(static)
+    for (long long n=0; n<(long long)count; n++)
+    {
+        set_position(n, particles[n].position(0), particles[n].position(1));
+        set_velocity(n, particles[n].velocity(0), particles[n].velocity(1));
+        mass[n] = particles[n].mass;
+        range[n] = particles[n].range;
+        pressure[n] = particles[n].pressure;
+    }
+}
+
+template<typename Policy>
+void ParticleStore<Policy>::store(std::vector<SPHParticle>& particles) const
+{
+    particles.resize(size());
+
+    #pragma omp parallel for schedule(static)
+    for (long long n=0; n<(long long)size(); n++)
+    {
+        SPHParticle& particle = particles[n];
+        const std::array<double,2> point = position(n);
+        particle.position = {point[0], point[1]};
+        particle.range = range[n];
+        if (!active[n])
+        {
+            particle.velocity = {0., 0.};
+            particle.mass = 0.;
+            particle.pressure = 0.;
+            continue;
+        }
+        const std::array<double,2> speed = velocity(n);
+        particle.velocity = {speed[0], speed[1]};
+        particle.mass = mass[n];
+        particle.pressure = pressure[n];
+    }
+}
+
+template<typename Policy>
+std::size_t ParticleStore<Policy>::insert(double _x, double _y,
+                                          double _vx, double _vy,
+                                          double _mass, double _range)
+{
+    std::size_t n;
+    if (!free_slots.empty())
+    {
+        n = free_slots.back();
+        free_slots.pop_back();
+    }
+    else
+    {
+        n = size();
+        x.push_back(0.);
+        y.push_back(0.);
+        if constexpr (Policy::cell_relative)
+        {
+            anchor_x.push_back(0);
+            anchor_y.push_back(0);
+        }
+        vx.push_back(0.);
+        vy.push_back(0.);
+        if constexpr (reduced)
+        {
+            exact_x.push_back(0.);
+            exact_y.push_back(0.);
+            exact_vx.push_back(0.);
+            exact_vy.push_back(0.);
+        }
+        mass.push_back(0.);
+        range.push_back(0.);
+        density.push_back(0.);
+        pressure.push_back(0.);
+        active.push_back(0);
+    }
+
+    set_position(n, _x, _y);
+    set_velocity(n, _vx, _vy);
+    mass[n] = _mass;
+    range[n] = _range;
+    density[n] = 0.;
+    pressure[n] = 0.;
+    active[n] = 1;
+    return n;
+}
+
+template<typename Policy>
+void ParticleStore<Policy>::remove(std::size_t n)
+{
+    // A free slot has no mass, so a stale read of it adds nothing
+    active[n] = 0;
+    mass[n] = 0.;
+    free_slots.push_back(n);
+}
+
+template<typename Policy>
+void ParticleStore<Policy>::compact(const std::vector<unsigned int>& order)
+{
+    auto reorder = [&order](auto& column)
+    {
+        typename std::remove_reference<decltype(column)>::type
+            reordered(order.size());
+        #pragma omp parallel for schedule(static)
+        for (long long k=0; k<(long long)order.size(); k++)
+            reordered[k] = column[order[k]];
+        column.swap(reordered);
+    };
+
+    reorder(x);
+    reorder(y);
+    if constexpr (Policy::cell_relative)
+    {
+        reorder(anchor_x);
+        reorder(anchor_y);
+    }
+    reorder(vx);
+    reorder(vy);
+    if constexpr (reduced)
+    {
+        reorder(exact_x);
+        reorder(exact_y);
+        reorder(exact_vx);
+        reorder(exact_vy);
+    }
+    reorder(mass);
+    reorder(range);
+    reorder(density);
+    reorder(pressure);
+    active.assign(order.size(), 1);
+    free_slots.clear();
+}
+
+template<typename Policy>
+void ParticleStore<Policy>::swap_velocities(std::vector<double>& next_vx,
+                                           std::vector<double>& next_vy)
+{
+    if constexpr (reduced)
+    {
+        exact_vx.swap(next_vx);
+        exact_vy.swap(next_vy);
+        #pragma omp parallel for schedule(static)
+        for (long long n=0; n<(long long)size(); n++)
+        {
+            vx[n] = exact_vx[n];
+            vy[n] = exact_vy[n];
+        }
+    }
+    else
+    {
+        vx.swap(next_vx);
+        vy.swap(next_vy);
+    }
+}
+
+template<typename Policy>
+double ParticleStore<Policy>::max_range() const
+{
+    double largest = 0.;
+    #pragma omp parallel for schedule(static) reduction(max:largest)
+    for (long long n=0; n<(long long)size(); n++)
+    {
+        if (active[n])
+            largest = std::max(largest, (double)range[n]);
+    }
+    return largest;
+}
+
+template<typename Policy>
+void compute_density(ParticleStore<Policy>& store, const Grid& grid)
+{
+    const double max_range = store.max_range();
+
+    #pragma omp parallel for schedule(static)
+    for (long long i=0; i<(long long)store.size(); i++)
+    {
+        const std::array<double,2> point = store.position(i);
+        double density = 0.;
+        grid.for_each_candidate(point[0], point[1], max_range,
+            [&](unsigned int j)
+            {
+                const std::array<double,2> separation = store.separation(i, j);
+                const double range = store.range[j];
+                const double distance = std::sqrt(separation[0]*separation[0]
+                                                + separation[1]*separation[1]);
+                if (distance < range)
+                    density += store.mass[j]
+                        * cubic_sph_kernel_2d(distance / range)
+                        / (range*range);
+            });
+        store.density[i] = density;
+    }
+}
+
+template class ParticleStore<DoublePolicy>;
+template class ParticleStore<SinglePolicy>;
+template class ParticleStore<CellRelativePolicy>;
+template void compute_density(ParticleStore<DoublePolicy>&, const Grid&);
+template void compute_density(ParticleStore<SinglePolicy>&, const Grid&);
+template void compute_density(ParticleStore<CellRelativePolicy>&,
+                              const Grid&);
+
+// Run the density sum through the given policy, and measure it against the
+// double precision result
+template<typename Policy>
+static PrecisionError measure(const std::vector<SPHParticle>& particles,
+                              const ParticleStore<DoublePolicy>& reference,
+                              double xmin, double ymin, double anchor_size)
+{
+    ParticleStore<Policy> store;
+    store.load(particles, xmin, ymin, anchor_size);
+
+    Grid grid;
+    grid.build(store.size(),
+               [&store](std::size_t n) { return store.position(n); },
+               store.max_range());
+    compute_density(store, grid);
+
+    PrecisionError error = {0., 0., 0., 0., 0., 0.,
+                            store.bytes_per_particle()};
+    double squares = 0.;
+    for (std::size_t n=0; n<store.size(); n++)
+    {
+        const std::array<double,2> point = store.input_position(n);
+        const std::array<double,2> exact = reference.position(n);
+        error.position_max = std::max(error.position_max,
+            std::hypot(point[0]-exact[0], point[1]-exact[1]));
+        error.velocity_max = std::max(error.velocity_max,
+            std::hypot(store.vx[n]-reference.vx[n],
+                       store.vy[n]-reference.vy[n]));
+
+        if (reference.density[n] > 0.)
+        {
+            const double relative = std::abs(store.density[n]
+                - reference.density[n]) / reference.density[n];
+            error.density_max = std::max(error.density_max, relative);
+            squares += relative*relative;
+        }
+    }
+    if (store.size() > 0)
+        error.density_rms = std::sqrt(squares / store.size());
+
+    return error;
+}
+
+static ParticleStore<DoublePolicy> reference_density(
+    const std::vector<SPHParticle>& particles, double xmin, double ymin,
+    double anchor_size)
+{
+    ParticleStore<DoublePolicy> reference;
+    reference.load(particles, xmin, ymin, anchor_size);
+
+    Grid grid;
+    grid.build(reference.size(),
+               [&reference](std::size_t n) { return reference.position(n); },
+               reference.max_range());
+    compute_density(reference, grid);
+
+    return reference;
+}
+
+PrecisionError compare_precision(const std::vector<SPHParticle>& particles,
+                                 Precision precision, double xmin,
+                                 double ymin, double anchor_size)
+{
+    const ParticleStore<DoublePolicy> reference =
+        reference_density(particles, xmin, ymin, anchor_size);
+
+    switch (precision)
+    {
+        case Precision::single_precision:
+            return measure<SinglePolicy>(particles, reference,
+                                         xmin, ymin, anchor_size);
+        case Precision::cell_relative:
+            return measure<CellRelativePolicy>(particles, reference,
+                                               xmin, ymin, anchor_size);
+        default:
+            return measure<DoublePolicy>(particles, reference,
+                                         xmin, ymin, anchor_size);
+    }
+}
+
+// Largest distance of a run from the reference run, slot by slot
+static void compare_trajectory(const std::vector<SPHParticle>& run,
+                               const std::vector<SPHParticle>& reference,
+                               PrecisionError& error)
+{
+    const std::size_t count = std::min(run.size(), reference.size());
+    for (std::size_t n=0; n<count; n++)
+    {
+        if (run[n].mass <= 0. || reference[n].mass <= 0.)
+            continue;
+        error.trajectory_position_max = std::max(
+            error.trajectory_position_max,
+            std::hypot(run[n].position(0) - reference[n].position(0),
+                       run[n].position(1) - reference[n].position(1)));
+        error.trajectory_velocity_max = std::max(
+            error.trajectory_velocity_max,
+            std::hypot(run[n].velocity(0) - reference[n].velocity(0),
+                       run[n].velocity(1) - reference[n].velocity(1)));
+    }
+}
+
+void report_precision(
+    const std::vector<SPHParticle>& particles,
+    const std::array<std::vector<SPHParticle>,3>& trajectories,
+    unsigned int steps, double xmin, double ymin, double anchor_size,
+    std::ostream& os)
+{
+    const Precision precisions[2] = {Precision::single_precision,
+                                     Precision::cell_relative};
+    PrecisionError errors[2];
+    for (int k=0; k<2; k++)
+    {
+        errors[k] = compare_precision(particles, precisions[k],
+                                      xmin, ymin, anchor_size);
+        compare_trajectory(trajectories[(int)precisions[k]],
+                           trajectories[(int)Precision::double_precision],
+                           errors[k]);
+    }
+
+    os << "Precision error against double ("
+       << ParticleStore<DoublePolicy>::bytes_per_particle()
+       << " bytes per particle), trajectories after " << steps
+       << " steps:\n"
+       << "policy\tbytes\tposition\tvelocity\tdensity max\t"
+              << "density rms\ttrajectory position\ttrajectory velocity\n";
+    for (int k=0; k<2; k++)
+    {
+        const PrecisionError& error = errors[k];
+        os << precision_name(precisions[k]) << '\t'
+           << error.bytes_per_particle << '\t'
+           << error.position_max << '\t'
+           << error.velocity_max << '\t'
+           << error.density_max << '\t'
+           << error.density_rms << '\t'
+           << error.trajectory_position_max << '\t'
+           << error.trajectory_velocity_max << '\n';
+    }
+}
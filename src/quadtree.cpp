@@ -0,0 +1,222 @@
+// File: quadtree.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the quadtree.h header
+//
+
+#include "quadtree.h"
+#include "kernel.h"
+#include "loader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+// Kernel sum of the density at a point, using the grid to skip particles
+// that are out of range. Periodic images come from the grid.
+static double density_at(double x, double y,
+                         const std::vector<SPHParticle>& particles,
+                         const Grid& grid, double max_range)
+{
+    double density = 0.;
+    grid.for_each_image(x, y, max_range,
+        [&](unsigned int n, double shift_x, double shift_y)
+    {
+        const double separation_x = particles[n].position(0) + shift_x - x;
+        const double separation_y = particles[n].position(1) + shift_y - y;
+        const double distance = std::sqrt(separation_x*separation_x
+                                          + separation_y*separation_y);
+        if (distance < particles[n].range)
+            density += particles[n].mass
+                * cubic_sph_kernel_2d(distance / particles[n].range)
+                / (particles[n].range*particles[n].range);
+    });
+    return density;
+}
+
+void Quadtree::build(const std::vector<SPHParticle>& particles,
+                     const Grid& grid, double _xmin, double _ymin,
+                     double _width, double _height)
+{
+    xmin = _xmin;
+    ymin = _ymin;
+    width = _width;
+    height = _height;
+    nodes.clear();
+
+    double max_range = 0.;
+    for (const SPHParticle& particle : particles)
+        max_range = std::max(max_range, particle.range);
+
+    // The tolerance is relative to the densest point of the fluid. The
+    // density at each particle is kept for the refinement test as well.
+    std::vector<double> at_particle(particles.size());
+    double reference = 0.;
+    #pragma omp parallel for schedule(static) reduction(max:reference)
+    for (long long n=0; n<(long long)particles.size(); n++)
+    {
+        at_particle[n] = density_at(particles[n].position(0),
+                                    particles[n].position(1),
+                                    particles, grid, max_range);
+        reference = std::max(reference, at_particle[n]);
+    }
+    const double threshold = tolerance*reference;
+
+    // Refine one level at a time. Each node in the frontier carries the
+    // particles inside of it, so that crowding can be checked.
+    nodes.push_back({xmin, ymin, width, height, 0, -1, {0.f, 0.f, 0.f, 0.f}});
+    std::vector<int> frontier = {0};
+    std::vector<std::vector<unsigned int>> contents(1);
+    for (unsigned int n=0; n<particles.size(); n++)
+    {
+        const double x = particles[n].position(0);
+        const double y = particles[n].position(1);
+        if (x >= xmin && x <= xmin+width && y >= ymin && y <= ymin+height)
+            contents[0].push_back(n);
+    }
+
+    while (!frontier.empty())
+    {
+        std::vector<char> split(frontier.size(), 0);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int k=0; k<(int)frontier.size(); k++)
+        {
+            Node& node = nodes[frontier[k]];
+            double values[5];
+            for (int corner=0; corner<4; corner++)
+            {
+                values[corner] = density_at(
+                    node.x + (corner & 1)*node.size_x,
+                    node.y + (corner >> 1)*node.size_y,
+                    particles, grid, max_range);
+                node.corners[corner] = values[corner];
+            }
+            values[4] = density_at(node.x + 0.5*node.size_x,
+                                   node.y + 0.5*node.size_y,
+                                   particles, grid, max_range);
+
+            // The corners and center alone miss a cluster that fits between
+            // them, so the field at the particles inside counts as well
+            double low = *std::min_element(values, values+5);
+            double high = *std::max_element(values, values+5);
+            for (unsigned int n : contents[k])
+            {
+                low = std::min(low, at_particle[n]);
+                high = std::max(high, at_particle[n]);
+            }
+            const double variation = high - low;
+            if (node.depth < max_depth
+                && (variation > threshold
+                    || contents[k].size() > max_particles))
+                split[k] = 1;
+        }
+
+        std::vector<int> next_frontier;
+        std::vector<std::vector<unsigned int>> next_contents;
+        for (int k=0; k<(int)frontier.size(); k++)
+        {
+            if (!split[k])
+                continue;
+
+            // Copy, since push_back may reallocate nodes
+            const Node parent = nodes[frontier[k]];
+            nodes[frontier[k]].first_child = nodes.size();
+            const double half_x = 0.5*parent.size_x;
+            const double half_y = 0.5*parent.size_y;
+            for (int child=0; child<4; child++)
+            {
+                next_frontier.push_back(nodes.size());
+                nodes.push_back({parent.x + (child & 1)*half_x,
+                                 parent.y + (child >> 1)*half_y,
+                                 half_x, half_y, parent.depth+1, -1,
+                                 {0.f, 0.f, 0.f, 0.f}});
+                next_contents.emplace_back();
+            }
+
+            const std::size_t first = next_contents.size() - 4;
+            for (unsigned int n : contents[k])
+            {
+                const int child = (particles[n].position(0) >= parent.x+half_x)
+                    + 2*(particles[n].position(1) >= parent.y+half_y);
+                next_contents[first+child].push_back(n);
+            }
+        }
+
+        frontier.swap(next_frontier);
+        contents.swap(next_contents);
+    }
+}
+
+double Quadtree::sample(double x, double y) const
+{
+    if (nodes.empty() || x < xmin || x > xmin+width
+        || y < ymin || y > ymin+height)
+        return 0.;
+
+    int node = 0;
+    while (nodes[node].first_child >= 0)
+    {
+        const Node& parent = nodes[node];
+        node = parent.first_child + (x >= parent.x + 0.5*parent.size_x)
+               + 2*(y >= parent.y + 0.5*parent.size_y);
+    }
+
+    const Node& leaf = nodes[node];
+    const double s = (x - leaf.x)/leaf.size_x;
+    const double t = (y - leaf.y)/leaf.size_y;
+    return (1.-s)*(1.-t)*leaf.corners[0] + s*(1.-t)*leaf.corners[1]
+           + (1.-s)*t*leaf.corners[2] + s*t*leaf.corners[3];
+}
+
+std::size_t Quadtree::leaf_count() const
+{
+    return std::count_if(nodes.begin(), nodes.end(),
+                         [](const Node& node) { return node.first_child < 0; });
+}
+
+void Quadtree::collect(int node, std::vector<unsigned char>& split,
+                       std::vector<float>& corners) const
+{
+    if (nodes[node].first_child < 0)
+    {
+        split.push_back(0);
+        corners.insert(corners.end(), nodes[node].corners,
+                       nodes[node].corners+4);
+        return;
+    }
+
+    split.push_back(1);
+    for (int child=0; child<4; child++)
+        collect(nodes[node].first_child + child, split, corners);
+}
+
+void Quadtree::write(const std::string& name) const
+{
+    if (nodes.empty())
+        throw std::invalid_argument("Quadtree written before build");
+
+    std::vector<unsigned char> split;
+    std::vector<float> corners;
+    split.reserve(nodes.size());
+    collect(0, split, corners);
+
+    std::ofstream os(name, std::ios::binary);
+    if (!os)
+        throw std::runtime_error("could not open " + name);
+
+    BinaryHeader header;
+    std::memcpy(header.magic, "SPHQ", 4);
+    header.version = 1;
+    header.count = nodes.size();
+    const double extent[4] = {xmin, ymin, width, height};
+    const std::uint32_t depth[2] = {(std::uint32_t)max_depth, 0};
+
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os.write(reinterpret_cast<const char*>(extent), sizeof(extent));
+    os.write(reinterpret_cast<const char*>(depth), sizeof(depth));
+    os.write(reinterpret_cast<const char*>(split.data()), split.size());
+    os.write(reinterpret_cast<const char*>(corners.data()),
+             corners.size()*sizeof(float));
+}
@@ -0,0 +1,240 @@
+// File: renderer.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the renderer.h header
+//
+
+#include "renderer.h"
+#include "kernel.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+// Rows of pixels per band. Each band is splatted by one thread, so no two
+// threads ever write to the same pixel.
+static const int band_rows = 16;
+
+ColorField parse_color_field(const std::string& name)
+{
+    if (name == "density")
+        return ColorField::density;
+    else if (name == "speed")
+        return ColorField::speed;
+    else if (name == "pressure")
+        return ColorField::pressure;
+    else
+        throw std::invalid_argument("unknown render field " + name);
+}
+
+Renderer::~Renderer()
+{
+    if (pipe != nullptr)
+        pclose(pipe);
+}
+
+void Renderer::render(const std::vector<SPHParticle>& particles,
+                      double xmin, double ymin, double width, double height,
+                      const std::string& name)
+{
+    if (pixels_x <= 0 || pixels_y <= 0)
+        throw std::invalid_argument("render size must be positive");
+
+    splat(particles, xmin, ymin, width, height);
+    color();
+    write(name);
+}
+
+void Renderer::splat(const std::vector<SPHParticle>& particles,
+                     double xmin, double ymin, double width, double height)
+{
+    const double dx = width / pixels_x;
+    const double dy = height / pixels_y;
+    const int band_count = (pixels_y + band_rows - 1) / band_rows;
+
+    weight.assign(pixels_x*pixels_y, 0.);
+    value.assign(pixels_x*pixels_y, 0.);
+
+    // Sort the particles into the bands that the footprint of any of their
+    // images overlaps
+    std::vector<std::vector<unsigned int>> bands(band_count);
+    double shift_x[9], shift_y[9];
+    for (unsigned int n=0; n<particles.size(); n++)
+    {
+        const double range = particles[n].range;
+        const int images = periodicity.images(particles[n].position(0),
+            particles[n].position(1), range, shift_x, shift_y);
+        for (int k=0; k<images; k++)
+        {
+            const double y = particles[n].position(1) + shift_y[k];
+            int row_start = std::max(0,
+                (int)std::ceil((y-range-ymin)/dy - 0.5));
+            int row_end = std::min(pixels_y-1,
+                (int)std::floor((y+range-ymin)/dy - 0.5));
+            if (row_start > row_end)
+                continue;
+            for (int band = row_start/band_rows; band <= row_end/band_rows;
+                 band++)
+            {
+                if (bands[band].empty() || bands[band].back() != n)
+                    bands[band].push_back(n);
+            }
+        }
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int band=0; band<band_count; band++)
+    {
+        const int band_start = band*band_rows;
+        const int band_end = std::min(pixels_y, band_start+band_rows) - 1;
+
+        double image_x[9], image_y[9];
+        for (unsigned int n : bands[band])
+        {
+            const SPHParticle& particle = particles[n];
+            const double range = particle.range;
+
+            double quantity = 0.;
+            if (field == ColorField::speed)
+                quantity = arma::norm(particle.velocity, 2);
+            else if (field == ColorField::pressure)
+                quantity = particle.pressure;
+
+            const int images = periodicity.images(particle.position(0),
+                particle.position(1), range, image_x, image_y);
+            for (int k=0; k<images; k++)
+            {
+                const double x = particle.position(0) + image_x[k];
+                const double y = particle.position(1) + image_y[k];
+
+                int column_start =
+                    std::max(0, (int)std::ceil((x-range-xmin)/dx - 0.5));
+                int column_end = std::min(pixels_x-1,
+                    (int)std::floor((x+range-xmin)/dx - 0.5));
+                int row_start = std::max(band_start,
+                    (int)std::ceil((y-range-ymin)/dy - 0.5));
+                int row_end = std::min(band_end,
+                    (int)std::floor((y+range-ymin)/dy - 0.5));
+
+                for (int j=row_start; j<=row_end; j++)
+                {
+                    const double separation_y = ymin + (j+0.5)*dy - y;
+                    for (int i=column_start; i<=column_end; i++)
+                    {
+                        const double separation_x = xmin + (i+0.5)*dx - x;
+                        const double q = std::sqrt(separation_x*separation_x
+                            + separation_y*separation_y) / range;
+                        if (q > 1.)
+                            continue;
+
+                        const double w = particle.mass * cubic_sph_kernel_2d(q)
+                                         / (range*range);
+                        weight[j*pixels_x + i] += w;
+                        value[j*pixels_x + i] += w*quantity;
+                    }
+                }
+            }
+        }
+    }
+
+    // Density is the kernel sum itself, the other fields are kernel
+    // weighted averages
+    if (field != ColorField::density)
+    {
+        #pragma omp parallel for schedule(static)
+        for (int p=0; p<pixels_x*pixels_y; p++)
+        {
+            if (weight[p] > 0.)
+                value[p] /= weight[p];
+        }
+    }
+    else
+        value = weight;
+}
+
+// Map the field onto an approximation of the viridis colormap
+void Renderer::color()
+{
+    static const double stops[5][3] = {{68., 1., 84.},
+                                       {59., 82., 139.},
+                                       {33., 145., 140.},
+                                       {94., 201., 98.},
+                                       {253., 231., 37.}};
+
+    double lower = value_min;
+    double upper = value_max;
+    if (lower == upper)
+    {
+        lower = DBL_MAX;
+        upper = -DBL_MAX;
+        #pragma omp parallel for schedule(static) \
+            reduction(min:lower) reduction(max:upper)
+        for (int p=0; p<pixels_x*pixels_y; p++)
+        {
+            if (weight[p] > 0.)
+            {
+                lower = std::min(lower, value[p]);
+                upper = std::max(upper, value[p]);
+            }
+        }
+    }
+    const double scale = (upper > lower) ? 1./(upper-lower) : 0.;
+
+    image.resize(3*pixels_x*pixels_y);
+
+    #pragma omp parallel for schedule(static)
+    for (int j=0; j<pixels_y; j++)
+    {
+        // Images are stored top row first, while j increases upwards
+        unsigned char* row = &image[3*(pixels_y-1-j)*pixels_x];
+        for (int i=0; i<pixels_x; i++)
+        {
+            const int p = j*pixels_x + i;
+            if (weight[p] <= 0.)
+            {
+                row[3*i] = row[3*i+1] = row[3*i+2] = 0;
+                continue;
+            }
+
+            double t = std::min(1., std::max(0., (value[p]-lower)*scale));
+            int stop = std::min(3, (int)(4.*t));
+            double fraction = 4.*t - stop;
+            for (int c=0; c<3; c++)
+            {
+                row[3*i+c] = (unsigned char)(stops[stop][c]
+                    + fraction*(stops[stop+1][c]-stops[stop][c]) + 0.5);
+            }
+        }
+    }
+}
+
+void Renderer::write(const std::string& name)
+{
+    if (output == "ppm")
+    {
+        const std::string path = directory + "frames/" + name + ".ppm";
+        FILE* file = fopen(path.c_str(), "wb");
+        if (file == nullptr)
+            throw std::runtime_error("could not open " + path);
+        fprintf(file, "P6\n%d %d\n255\n", pixels_x, pixels_y);
+        fwrite(image.data(), 1, image.size(), file);
+        fclose(file);
+    }
+    else if (output == "ffmpeg")
+    {
+        if (pipe == nullptr)
+        {
+            std::string command = "ffmpeg -y -loglevel error -f rawvideo"
+                " -pixel_format rgb24 -video_size "
+                + std::to_string(pixels_x) + 'x' + std::to_string(pixels_y)
+                + " -framerate 60 -i - -pix_fmt yuv420p -vcodec libx264 "
+                + directory + "movie.mp4";
+            pipe = popen(command.c_str(), "w");
+            if (pipe == nullptr)
+                throw std::runtime_error("could not start ffmpeg");
+        }
+        fwrite(image.data(), 1, image.size(), pipe);
+    }
+    else
+        throw std::invalid_argument("unknown render output " + output);
+}
@@ -7,39 +7,20 @@
 
 #include "simulation.h"
 #include "geometry.h"
+#include "loader.h"
+#include "integrator.h"
+#include "boundary.h"
+#include <chrono>
 #include <typeinfo>
 #include <fstream>
 #include <stdexcept>
 #include <cmath> // for zero filling
 #include <iomanip>
-
-/*
-// The grid structure for tracking neighbors
-// On construction, calculate bounding box and determine cell size
-// from the particles, and then use a sorting function to sort the
-// particles for increased cache hits and ease/speed of access. After
-// sorting, neighbors are determined and tracked.
-class Grid
-{
-    double cell_size;
-
-    // Kitty corner vertices, 2 x dimension
-    arma::Mat<double> coordinate_limits;
-
-    // List of pointers with each pointer going to the first particle
-    // in the cell, represented either by a block of an array or a
-    // linked list
-
-public:
-    std::vector<Particle> &particles;
-};
-*/
-// Take in grid and sort particles according to the cell
-// index inherited from the grid
-// void index_sort(Grid);
+#include <sstream>
 
 // Sort according to z-curve, which has better spatial coherence
-// than index_sort() and is accessed quickly through bitwise operations
+// than the cell order of Grid and is accessed quickly through bitwise
+// operations
 // void z_curve_sort(Grid);
 
 // Compact hashing
@@ -47,10 +28,48 @@ public:
 
 
 
-//TODO: Make constructor able to take terminal or file input
-Simulation::Simulation()
+// Read "x y" lines, skipping blank and comment lines
+static std::vector<std::array<double,2>> read_points(const std::string& name)
+{
+    std::ifstream is(name);
+    if (!is)
+        throw std::runtime_error("could not open " + name);
+
+    std::vector<std::array<double,2>> points;
+    std::string line;
+    while (std::getline(is, line))
+    {
+        if (line.length() == 0 || line[0] == '#')
+            continue;
+        std::istringstream tokens(line);
+        double x, y;
+        if (!(tokens >> x >> y))
+            throw std::invalid_argument("bad point in " + name + ": " + line);
+        points.push_back({x, y});
+    }
+    return points;
+}
+
+//TODO: Make constructor able to take terminal input
+Simulation::Simulation(const std::string& input_name,
+                       const std::string& _directory,
+                       BoundaryCache* boundary_cache)
+    : directory(_directory)
 {
-    is.open("input.txt");
+    // Simulations with an output directory log there instead of stdout
+    if (!directory.empty())
+    {
+        if (directory.back() != '/')
+            directory += '/';
+        system(("mkdir -p " + directory).c_str());
+        log_file.open(directory + "sph.log");
+        log = &log_file;
+    }
+    renderer.directory = directory;
+
+    is.open(input_name);
+    if (!is)
+        throw std::runtime_error("could not open " + input_name);
     std::vector<std::string> tokens;
 
     // Get number of particles and initialize particles
@@ -58,100 +77,248 @@ Simulation::Simulation()
     if (tokens[0] != "particle_num")
         throw std::invalid_argument("line 0 is not particle_num");
     unsigned int particle_num = stoi(tokens[1]);
-    particles = std::vector<SPHParticle>(particle_num);
-    std::cout << "Number of Particles: " << particle_num << std::endl;
 
     // Set up time
     tokens = next_line();
     if (tokens[0] != "timestep")
         throw std::invalid_argument("line 1 is not timestep");
     dt = stod(tokens[1]);
-    std::cout << "Timestep: " << dt << ' ';
+    *log << "Timestep: " << dt << ' ';
 
     tokens = next_line();
     if (tokens[0] != "duration")
         throw std::invalid_argument("line 2 is not duration");
     duration = stod(tokens[1]);
-    std::cout << "Duration: " << duration << '\n';
+    *log << "Duration: " << duration << '\n';
     max_step = int(duration/dt);
 
-    is.close();
-
-    // Read in vertices of polygon boundary
-    Polygon domain;
-
-    is.open("boundary.txt");
-    do
+    // The remaining parameters are optional, and can be given in any order.
+    // Unless it is given, the rest density is the initial mean density.
+    eos.rest_density = 0.;
+    std::string particle_path;
+    std::string vertex_path;
+    while (!is.eof())
     {
         tokens = next_line();
-        domain.vertices.push_back(arma::vec(tokens[0]+' '+tokens[1]));
-    } while(!is.eof());
+        if (tokens[0].empty())
+            continue;
+        else if (tokens[0] == "initial_conditions")
+        {
+            if (tokens.size() < 3)
+                throw std::invalid_argument(
+                    "initial_conditions needs a particle and a vertex file");
+            particle_path = tokens[1];
+            vertex_path = tokens[2];
+        }
+        else if (tokens[0] == "dump_interval")
+            dump_interval = stoi(tokens[1]);
+        else if (tokens[0] == "sample_interval")
+            sample_interval = stoi(tokens[1]);
+        else if (tokens[0] == "sample_size")
+        {
+            sample_x = stoi(tokens[1]);
+            sample_y = stoi(tokens[2]);
+        }
+        else if (tokens[0] == "sample_mode")
+        {
+            if (tokens[1] != "uniform" && tokens[1] != "adaptive")
+                throw std::invalid_argument("unknown sample_mode "+tokens[1]);
+            sample_adaptive = (tokens[1] == "adaptive");
+        }
+        else if (tokens[0] == "quadtree_depth")
+            quadtree.max_depth = stoi(tokens[1]);
+        else if (tokens[0] == "quadtree_tolerance")
+            quadtree.tolerance = stod(tokens[1]);
+        else if (tokens[0] == "quadtree_particles")
+            quadtree.max_particles = stoi(tokens[1]);
+        else if (tokens[0] == "sample_tile_size")
+            density_sampler.tile_size = stoi(tokens[1]);
+        else if (tokens[0] == "sample_tolerance")
+            density_sampler.tolerance = stod(tokens[1]);
+        else if (tokens[0] == "boundary_file")
+            boundary_file = tokens[1];
+        else if (tokens[0] == "boundary_thickness")
+            boundary_thickness = stod(tokens[1]);
+        else if (tokens[0] == "inflow")
+        {
+            Inflow inflow;
+            inflow.edge = stoi(tokens.at(1));
+            inflow.speed = stod(tokens.at(2));
+            if (tokens.size() > 3)
+                inflow.spacing = stod(tokens[3]);
+            flow.inflows.push_back(inflow);
+        }
+        else if (tokens[0] == "outflow")
+            flow.outflows.push_back(stoi(tokens.at(1)));
+        else if (tokens[0] == "compact_interval")
+            compact_interval = stoi(tokens[1]);
+        else if (tokens[0] == "periodic")
+        {
+            for (std::size_t k=1; k<tokens.size(); k++)
+            {
+                if (tokens[k] == "x")
+                    periodicity.x = true;
+                else if (tokens[k] == "y")
+                    periodicity.y = true;
+                else
+                    throw std::invalid_argument("unknown periodic axis "
+                                                + tokens[k]);
+            }
+        }
+        else if (tokens[0] == "rest_density")
+            eos.rest_density = stod(tokens[1]);
+        else if (tokens[0] == "bulk_modulus")
+            eos.bulk_modulus = stod(tokens[1]);
+        else if (tokens[0] == "bulk_modulus_derivative")
+            eos.bulk_modulus_derivative = stod(tokens[1]);
+        else if (tokens[0] == "background_pressure")
+            eos.background_pressure = stod(tokens[1]);
+        else if (tokens[0] == "gravity")
+        {
+            gravity_x = stod(tokens[1]);
+            gravity_y = stod(tokens[2]);
+        }
+        else if (tokens[0] == "viscosity")
+            viscosity = stod(tokens[1]);
+        else if (tokens[0] == "pair_cache")
+            pair_cache = (stoi(tokens[1]) != 0);
+        else if (tokens[0] == "pressure_solver")
+            pressure_solver = parse_pressure_solver(tokens[1]);
+        else if (tokens[0] == "solver_tolerance")
+            solver_tolerance = stod(tokens[1]);
+        else if (tokens[0] == "solver_max_iterations")
+            solver_max_iterations = stoi(tokens[1]);
+        else if (tokens[0] == "solver_relaxation")
+            solver_relaxation = stod(tokens[1]);
+        else if (tokens[0] == "cell_factor")
+            tuning.cell_factor = stod(tokens[1]);
+        else if (tokens[0] == "skin")
+            tuning.skin = stod(tokens[1]);
+        else if (tokens[0] == "sort_interval")
+            tuning.sort_interval = stoi(tokens[1]);
+        else if (tokens[0] == "chunk_size")
+            tuning.chunk_size = stoi(tokens[1]);
+        else if (tokens[0] == "auto_tune")
+            auto_tune = (stoi(tokens[1]) != 0);
+        else if (tokens[0] == "tune_steps")
+            tune_steps = stoi(tokens[1]);
+        else if (tokens[0] == "tune_drift")
+            tune_drift = stod(tokens[1]);
+        else if (tokens[0] == "precision")
+            precision = parse_precision(tokens[1]);
+        else if (tokens[0] == "precision_report")
+            precision_report = (stoi(tokens[1]) != 0);
+        else if (tokens[0] == "precision_report_steps")
+            precision_report_steps = stoi(tokens[1]);
+        else if (tokens[0] == "render_interval")
+            render_interval = stoi(tokens[1]);
+        else if (tokens[0] == "render_size")
+        {
+            renderer.pixels_x = stoi(tokens[1]);
+            renderer.pixels_y = stoi(tokens[2]);
+        }
+        else if (tokens[0] == "render_field")
+            renderer.field = parse_color_field(tokens[1]);
+        else if (tokens[0] == "render_range")
+        {
+            renderer.value_min = stod(tokens[1]);
+            renderer.value_max = stod(tokens[2]);
+        }
+        else if (tokens[0] == "render_output")
+            renderer.output = tokens[1];
+        else if (tokens[0] == "probe_file")
+            probes = read_points(tokens[1]);
+        else if (tokens[0] == "probe_interval")
+            probe_interval = stoi(tokens[1]);
+        else if (tokens[0] == "probe_shepard")
+            interpolator.shepard = (stoi(tokens[1]) != 0);
+        else if (tokens[0] == "metrics")
+            metrics_name = tokens.at(1);
+        else if (tokens[0] == "metrics_interval")
+            metrics_interval = stoi(tokens[1]);
+        else
+            throw std::invalid_argument("unknown parameter " + tokens[0]);
+    }
+
     is.close();
 
-    std::cout << "Vertices of the bounding polygon: \n";
-    for (int i = 0; i<domain.vertices.size(); i++)
+    if (probe_interval > 0 && probes.empty())
+        throw std::invalid_argument("probe_interval needs a probe_file");
+    if (tuning.cell_factor <= 0. || tuning.skin < 0. || tuning.chunk_size < 0)
+        throw std::invalid_argument("cell_factor must be positive, and skin "
+                                    "and chunk_size not negative");
+    if (auto_tune && tune_steps == 0)
+        throw std::invalid_argument("tune_steps must be positive");
+    // The movie is encoded as yuv420p, which halves both axes for color
+    if (render_interval > 0 && renderer.output == "ffmpeg"
+        && (renderer.pixels_x % 2 != 0 || renderer.pixels_y % 2 != 0))
+        throw std::invalid_argument("render_size must be even for ffmpeg "
+                                    "output");
+
+    // The polygon and its boundary layer only depend on the polygon file,
+    // the spacing, the periodic axes and the open edges, so they may be
+    // shared with other simulations
+    spacing = 0.01;
+    const std::string polygon_file =
+        particle_path.empty() ? boundary_file : vertex_path;
+    std::shared_ptr<const PreparedBoundary> prepared;
+    if (boundary_cache != nullptr)
+        prepared = boundary_cache->get(polygon_file, !particle_path.empty(),
+                                       spacing, boundary_thickness,
+                                       periodicity.x, periodicity.y,
+                                       flow.open_edges());
+    else
+        prepared = std::make_shared<const PreparedBoundary>(
+            prepare_boundary(polygon_file, !particle_path.empty(),
+                             spacing, boundary_thickness,
+                             periodicity.x, periodicity.y,
+                             flow.open_edges()));
+    domain = prepared->domain;
+    flow.prepare(domain);
+
+    xmin = prepared->xmin;
+    ymin = prepared->ymin;
+    width = prepared->xmax-xmin;
+    height = prepared->ymax-ymin;
+
+    // The period along each periodic axis is the extent of the polygon.
+    // Every spatial structure wraps at the same seams.
+    periodicity.xmin = xmin;
+    periodicity.ymin = ymin;
+    periodicity.length_x = width;
+    periodicity.length_y = height;
+    density_sampler.periodicity = periodicity;
+    renderer.periodicity = periodicity;
+    grid.periodicity = periodicity;
+
+    if (!particle_path.empty())
     {
-        std::cout << domain.vertices[i](0) << '\t' << domain.vertices[i](1) << '\n';
+        // Large initial conditions are generated externally, so the
+        // particles come from a binary file instead
+        load_particles(particle_path, domain, particles, periodicity);
+        *log << "Loaded " << particles.size() << " particles from "
+             << particle_path << '\n';
+        particle_num = particles.size();
     }
+    else
+        particles = std::vector<SPHParticle>(particle_num);
+    *log << "Number of Particles: " << particle_num << std::endl;
 
-    
-    double xmin = domain.vertices[0](0);
-    double xmax = xmin;
-    double ymin = domain.vertices[0](1);
-    double ymax = ymin;
-    
-    for (auto vertex : domain.vertices)
+    *log << "Vertices of the bounding polygon: \n";
+    for (int i = 0; i<domain.vertices.size(); i++)
     {
-        if (vertex(0) < xmin)
-            xmin = vertex(0);
-        else if (vertex(0) > xmax)
-            xmax = vertex(0);
-        if (vertex(1) < ymin)
-            ymin = vertex(1);
-        else if (vertex(1) > ymax)
-            ymax = vertex(1);
+        *log << domain.vertices[i](0) << '\t' << domain.vertices[i](1) << '\n';
     }
-
-    width = xmax-xmin;
-    height = ymax-ymin;
     
     arma::vec point;
 
-    spacing = 0.01;
-    for (double x = xmin-5.*spacing; x <= xmax+5.*spacing; x += spacing)
-    {
-        for (double y = ymin-5.*spacing; y <= ymax+5.*spacing; y += spacing)
-        {
-            point = {x,y};
-            if (point_inside_polygon(point, domain) == 0)
-            {
-                for (int i = 0; i<domain.vertices.size(); i++)
-                {
-                    double distance = distance_to_line_segment(
-                        point,
-                        Line_Segment(
-                            domain.vertices[i],
-                            domain.vertices[(i+1)
-                                %domain.vertices.size()]));
-
-                    if ( distance <= boundary_thickness*spacing )
-                    {
-                        boundary.push_back(SPHParticle());
-                        boundary.back().position = point;
-                    }
-                }
-            }
-        }
-    }
-
-    
-    // Initialize particles
+    // Initialize particles, unless they were already loaded
 
     std::default_random_engine generator;
     std::uniform_real_distribution<double> distribution(0.,1.);
     
     // Fill particle list
-    for (unsigned int i=0; i<particle_num; i++)
+    for (unsigned int i=0; i<particle_num && particle_path.empty(); i++)
     {
         particles[i] = SPHParticle();
         
@@ -168,89 +335,272 @@ Simulation::Simulation()
         particles[i].range = .1;
         particles[i].mass = 1.;
     }
-    
+
+    // Boundary particles take part in the sums with the range of an average
+    // fluid particle. Their mass is set by the integrator from the volume
+    // they cover.
+    double mean_range = 0.;
+    for (const SPHParticle& particle : particles)
+        mean_range += particle.range / particles.size();
+
+    // The boundary never moves, so it is binned once for the whole run, and
+    // shared with the other simulations that bin it the same way
+    double max_range = mean_range;
+    for (const SPHParticle& particle : particles)
+        max_range = std::max(max_range, particle.range);
+    if (boundary_cache != nullptr)
+        walls = boundary_cache->walls(prepared, periodicity, mean_range,
+                                      max_range);
+    else
+        walls = std::make_shared<const StaticBoundary>(
+            build_walls(*prepared, periodicity, mean_range, max_range));
+    *log << "Boundary particles: " << walls->size() << '\n';
+
+    anchor_size = max_range;
 
     // Set up directories for data dumping
     //TODO: Make system agnostic
-    system("mkdir -p data/positions");
-    system("mkdir -p data/velocities");
+    system(("mkdir -p " + directory + "data/positions").c_str());
+    system(("mkdir -p " + directory + "data/velocities").c_str());
+    if (sample_interval > 0)
+        system(("mkdir -p " + directory + "data/density").c_str());
+    if (render_interval > 0 && renderer.output == "ppm")
+        system(("mkdir -p " + directory + "frames").c_str());
 
 }
 
 Simulation::~Simulation()
 {
     os.close();
-    std::cout << "Done!" << std::endl;
+    *log << "Done!" << std::endl;
 }
 
 int Simulation::run()
 {
+    // The trajectories for the report are run without reordering or
+    // compacting the store, so that the particles stay in the same slots
+    if (precision_report)
+    {
+        const unsigned int steps = std::min(precision_report_steps, max_step);
+        const std::array<std::vector<SPHParticle>,3> trajectories = {
+            trajectory<DoublePolicy>(steps),
+            trajectory<SinglePolicy>(steps),
+            trajectory<CellRelativePolicy>(steps)};
+        report_precision(particles, trajectories, steps, xmin, ymin,
+                         anchor_size, *log);
+    }
+
+    // The storage precision is a template parameter, so that the neighbor
+    // loops are compiled for each one
+    switch (precision)
+    {
+        case Precision::single_precision:
+            return integrate<SinglePolicy>();
+        case Precision::cell_relative:
+            return integrate<CellRelativePolicy>();
+        default:
+            return integrate<DoublePolicy>();
+    }
+}
+
+template<typename Policy>
+void Simulation::configure(Integrator<Policy>& integrator) const
+{
+    integrator.eos = eos;
+    integrator.gravity_x = gravity_x;
+    integrator.gravity_y = gravity_y;
+    integrator.viscosity = viscosity;
+    integrator.cache_pairs = pair_cache;
+    integrator.periodicity = periodicity;
+    integrator.flow = flow;
+    integrator.compact_interval = compact_interval;
+    integrator.solver = pressure_solver;
+    integrator.solver_tolerance = solver_tolerance;
+    integrator.solver_max_iterations = solver_max_iterations;
+    integrator.solver_relaxation = solver_relaxation;
+    integrator.tuning = tuning;
+    integrator.auto_tune = auto_tune;
+    integrator.tuner.trial_steps = tune_steps;
+    integrator.tuner.drift = tune_drift;
+}
+
+template<typename Policy>
+std::vector<SPHParticle> Simulation::trajectory(unsigned int steps) const
+{
+    Integrator<Policy> integrator;
+    configure(integrator);
+    integrator.auto_tune = false;
+    integrator.tuning.sort_interval = 0;
+    integrator.compact_interval = 0;
+    integrator.initialize(particles, *walls, xmin, ymin);
+    for (unsigned int k=0; k<steps; k++)
+        integrator.step(dt, k+1 == steps);
+
+    std::vector<SPHParticle> result;
+    integrator.store(result);
+    return result;
+}
+
+template<typename Policy>
+int Simulation::integrate()
+{
+    Integrator<Policy> integrator;
+    configure(integrator);
+    integrator.initialize(particles, *walls, xmin, ymin);
+    eos = integrator.eos;
+    *log << "Rest density: " << eos.rest_density << '\n';
+
+    double min_range = particles.empty() ? 0. : particles[0].range;
+    for (const SPHParticle& particle : particles)
+        min_range = std::min(min_range, particle.range);
+    // The implicit solver isn't limited by the sound speed
+    const double stable_dt = 0.25*min_range/eos.sound_speed();
+    if (pressure_solver == PressureSolver::equation_of_state && dt > stable_dt)
+        *log << "Warning: timestep is above the estimated stable "
+             << "timestep " << stable_dt << '\n';
+
+    if (!metrics_name.empty())
+        metrics.open(metrics_name);
+    auto published = std::chrono::steady_clock::now();
+    unsigned int steps_since = 0;
+    double pairs_since = 0.;
+
     for(step=0; step<max_step; step++)
     {
-        dump_state();
+        if (output_due(step))
+        {
+            integrator.store(particles);
+            if (integrator.renumberings != sampled_renumberings)
+            {
+                density_sampler.reset();
+                sampled_renumberings = integrator.renumberings;
+            }
+            output();
+        }
+        if (probe_interval > 0 && step % probe_interval == 0)
+            write_probes(integrator);
 
         // run
-        std::cout << "step " << step << '\n';
-
+        if (!metrics.is_open())
+            *log << "step " << step << '\n';
+
+        // Velocities only need to be synchronized when they are written out
+        integrator.step(dt, output_due(step+1) || metrics_due(step+1)
+                            || step+1 == max_step);
+        steps_since++;
+        pairs_since += integrator.pairs;
+        if (metrics_due(step+1))
+        {
+            const auto now = std::chrono::steady_clock::now();
+            const double elapsed =
+                std::chrono::duration<double>(now - published).count();
+            const Observables observables = integrator.observables();
+            Metrics record;
+            record.step = step+1;
+            record.particles = integrator.live();
+            record.time = (step+1)*dt;
+            record.dt = dt;
+            if (elapsed > 0.)
+            {
+                record.steps_per_second = steps_since/elapsed;
+                record.pairs_per_second = pairs_since/elapsed;
+            }
+            record.kinetic_energy = observables.kinetic_energy;
+            record.potential_energy = observables.potential_energy;
+            record.internal_energy = observables.internal_energy;
+            record.momentum_x = observables.momentum_x;
+            record.momentum_y = observables.momentum_y;
+            record.resident_bytes = MetricsRing::resident_bytes();
+            metrics.publish(record);
+            published = now;
+            steps_since = 0;
+            pairs_since = 0.;
+        }
+        if (integrator.inserted > 0 || integrator.removed > 0)
+            *log << "inserted " << integrator.inserted << " removed "
+                 << integrator.removed << '\n';
+        if (pressure_solver == PressureSolver::iisph)
+            *log << "solver iterations " << integrator.solver_iterations
+                 << " density error " << integrator.solver_error << '\n';
+        if (integrator.tuned)
+            *log << "Tuned parameters (round " << integrator.tuner.rounds()
+                 << "), which can be pinned in input.txt:\n"
+                 << integrator.tuning.describe();
     }
+    integrator.store(particles);
+    metrics.close();
 
     return 0;
 }
 
+bool Simulation::metrics_due(unsigned int _step) const
+{
+    return metrics.is_open() && metrics_interval > 0
+        && _step % metrics_interval == 0;
+}
+
+bool Simulation::output_due(unsigned int _step) const
+{
+    return (dump_interval > 0 && _step % dump_interval == 0)
+        || (sample_interval > 0 && _step % sample_interval == 0)
+        || (render_interval > 0 && _step % render_interval == 0);
+}
+
+void Simulation::output()
+{
+    if (dump_interval > 0 && step % dump_interval == 0)
+        dump_state();
+    if (sample_interval > 0 && step % sample_interval == 0)
+    {
+        if (sample_adaptive)
+            sample_density_adaptive("data/density/"+padded_step()+".sphq");
+        else
+            sample_density(sample_x, sample_y,
+                           "data/density/"+padded_step()+".tsv");
+    }
+    if (render_interval > 0 && step % render_interval == 0)
+        renderer.render(particles, xmin, ymin, width, height,
+                        padded_step());
+}
+
 //TODO: Add saving of coordinates
-int Simulation::sample_density(int x_samples, int y_samples)
+int Simulation::sample_density(int x_samples, int y_samples,
+                               const std::string& name)
 {
     if (x_samples == 0 or y_samples == 0)
         throw std::invalid_argument("Either x_samples or y_samples is zero");
 
+    // Only the parts of the field that particles have disturbed since the
+    // last call are recomputed
+    density_sampler.resize(x_samples, y_samples, xmin, ymin, width, height);
+    density_sampler.update(particles);
+    const std::vector<double>& density = density_sampler.field();
+
     std::ofstream os;
     try
     {
-        os.open("density.tsv");
+        os.open(directory + name);
     }
     catch(const std::exception& e)
     {
         std::cerr << e.what() << '\n';
     }
     
-    os << "density.tsv\n";
+    os << name << '\n';
     os << std::to_string(x_samples) << '\t' << std::to_string(y_samples) <<'\n';
     os << std::to_string(width) << '\t' << std::to_string(height) <<'\n';
 
     // Set output mode to scientific
     os << std::scientific;
 
-    // Add up density contributions from all particles
-    // TODO: Add nearest neighbor functionality
-    double dx = width / (double)x_samples;
-    double dy = height / (double)y_samples;
-    double x;
-    double y;
-    double density = 0;
-    double distance;
-
     // TODO: may want to change output formatting to be conformant to numpy
-    x = 0.;
     for (int i=0; i<x_samples; i++)
     {
-        y = 0.;
         for (int j=0; j<y_samples; j++)
         {
-            // Loop through particles
-            for (int n=0; n<particles.size(); n++)
-            {
-                distance = arma::norm(particles[n].position 
-                    - arma::vec({x,y}), 2);
-                //std::cout << distance << '\t' << x << '\t' << y << '\n';
-                density += particles[n].mass
-                    * cubic_sph_kernel_2d(distance / particles[n].range);
-            }
-            os << std::setprecision(15) << density << '\t';
-            density = 0;
-            y += dy;
+            os << std::setprecision(15) << density[i*y_samples + j] << '\t';
         }
         os << '\n';
-        x += dx;
     }
     os << std::flush;
     os.close();
@@ -258,6 +608,21 @@ int Simulation::sample_density(int x_samples, int y_samples)
     return 0;
 }
 
+// Sample the density on a quadtree that is only refined where it is needed,
+// and write it in the binary format described in quadtree.h
+int Simulation::sample_density_adaptive(const std::string& name)
+{
+    double max_range = 0.;
+    for (const SPHParticle& particle : particles)
+        max_range = std::max(max_range, particle.range);
+
+    grid.build(particles, max_range);
+    quadtree.build(particles, grid, xmin, ymin, width, height);
+    quadtree.write(directory + name);
+
+    return 0;
+}
+
 // Filter out comment lines, skips through file until a non-comment line
 // is reached
 std::vector<std::string> Simulation::next_line()
@@ -291,18 +656,59 @@ std::vector<std::string> Simulation::next_line()
 }
 
 
-int Simulation::dump_state()
+// Do zero filling for filenames
+std::string Simulation::padded_step()
 {
-    // Do zero filling for filename
     std::string step_string = std::to_string(step);
     step_string.insert(step_string.begin(),
             log10(max_step)+1 - step_string.length(), '0');
+    return step_string;
+}
+
+// The columns are density, pressure, vx and vy for each probe in turn
+template<typename Policy>
+int Simulation::write_probes(const Integrator<Policy>& integrator)
+{
+    if (!probe_stream.is_open())
+    {
+        probe_stream.open(directory + "data/probes.tsv");
+        if (!probe_stream)
+            throw std::runtime_error("could not write to "
+                                     + directory + "data/probes.tsv");
+        for (std::size_t k=0; k<probes.size(); k++)
+            probe_stream << "# probe " << k << " at " << probes[k][0] << ' '
+                         << probes[k][1] << '\n';
+        probe_stream << "step\ttime";
+        for (std::size_t k=0; k<probes.size(); k++)
+            probe_stream << "\tdensity_" << k << "\tpressure_" << k
+                         << "\tvx_" << k << "\tvy_" << k;
+        probe_stream << '\n' << std::scientific << std::setprecision(9);
+    }
+
+    std::vector<double> values;
+    interpolator.probe(integrator, probes, values);
+
+    probe_stream << step << '\t' << step*dt;
+    for (double value : values)
+        probe_stream << '\t' << value;
+    probe_stream << '\n';
+
+    return 0;
+}
+
+int Simulation::dump_state()
+{
+    std::string step_string = padded_step();
 
     // Output position data
-    os.open("data/positions/"+step_string+".csv");
+    os.open(directory+"data/positions/"+step_string+".csv");
 
+    // Rows are numbered by slot, so a particle keeps its number between
+    // snapshots until the store is compacted. Free slots have no mass.
     for (int i=0; i<particles.size(); i++)
     {
+        if (particles[i].mass <= 0.)
+            continue;
         os << i << ','
            << particles[i].position[0] << ','
            << particles[i].position[1] << std::endl;
@@ -311,10 +717,12 @@ int Simulation::dump_state()
     os.close();
 
     // Output velocity data
-    os.open("data/velocities/"+step_string+".csv");
+    os.open(directory+"data/velocities/"+step_string+".csv");
 
     for (int i=0; i<particles.size(); i++)
     {
+        if (particles[i].mass <= 0.)
+            continue;
         os << i << ','
            << particles[i].velocity[0] << ','
            << particles[i].velocity[1] << std::endl;
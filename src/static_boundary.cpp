@@ -0,0 +1,85 @@
+// File: static_boundary.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the static_boundary.h header
+//
+
+#include "static_boundary.h"
+#include "kernel.h"
+#include <array>
+#include <cmath>
+
+void StaticBoundary::build(const std::vector<SPHParticle>& particles,
+                           const Periodicity& periodicity, double _radius)
+{
+    radius = _radius;
+    const std::size_t count = particles.size();
+    x.resize(count);
+    y.resize(count);
+    range.resize(count);
+    volume.resize(count);
+    for (std::size_t b=0; b<count; b++)
+    {
+        x[b] = particles[b].position(0);
+        y[b] = particles[b].position(1);
+        range[b] = particles[b].range;
+    }
+
+    grid.periodicity = periodicity;
+    grid.build(count,
+        [this](std::size_t b) -> std::array<double,2> { return {x[b], y[b]}; },
+        radius);
+
+    // Cells are at least radius wide, so anything within radius of a point
+    // is in the cell of the point or the ones around it
+    near_cell.assign(grid.cells_x*grid.cells_y, 0);
+    for (int i=0; i<grid.cells_x && count > 0; i++)
+    {
+        for (int j=0; j<grid.cells_y; j++)
+        {
+            const int cell = i*grid.cells_y + j;
+            if (grid.cell_start[cell] == grid.cell_start[cell+1])
+                continue;
+            for (int di=-1; di<=1; di++)
+            {
+                for (int dj=-1; dj<=1; dj++)
+                {
+                    int ni = i+di;
+                    int nj = j+dj;
+                    if (periodicity.x)
+                        ni = (ni + grid.cells_x) % grid.cells_x;
+                    if (periodicity.y)
+                        nj = (nj + grid.cells_y) % grid.cells_y;
+                    if (ni < 0 || ni >= grid.cells_x
+                        || nj < 0 || nj >= grid.cells_y)
+                        continue;
+                    near_cell[ni*grid.cells_y + nj] = 1;
+                }
+            }
+        }
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (long long b=0; b<(long long)count; b++)
+    {
+        // The volume is the inverse of the kernel sum over the wall
+        double number_density = 0.;
+        for_each_candidate(x[b], y[b],
+            [&](unsigned int c, double separation_x, double separation_y)
+            {
+                const double h = 0.5*(range[b] + range[c]);
+                const double distance = std::hypot(separation_x, separation_y);
+                if (distance < h)
+                    number_density += cubic_sph_kernel_2d(distance/h)
+                                      / (h*h);
+            });
+        volume[b] = 1. / number_density;
+    }
+}
+
+bool StaticBoundary::near(double _x, double _y) const
+{
+    if (near_cell.empty() || x.empty())
+        return false;
+    return near_cell[grid.cell_x(_x)*grid.cells_y + grid.cell_y(_y)];
+}
@@ -0,0 +1,171 @@
+// File: tuner.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// Implementation of the tuner.h header
+//
+
+#include "tuner.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <sstream>
+
+static const double cell_factors[] = {1., 0.5, 1./3.};
+static const double skins[] = {0., 0.1, 0.25, 0.5};
+static const int chunk_sizes[] = {0, 16, 64, 256};
+
+std::string Tuning::describe() const
+{
+    std::ostringstream out;
+    out << "cell_factor " << cell_factor << '\n'
+        << "skin " << skin << '\n'
+        << "sort_interval " << sort_interval << '\n'
+        << "chunk_size " << chunk_size << '\n';
+    return out.str();
+}
+
+void Tuner::start(const Tuning& initial)
+{
+    best = initial;
+    phase = Phase::cell_factor;
+    candidate = 0;
+    best_time = DBL_MAX;
+    try_candidate();
+}
+
+void Tuner::record_sort(double seconds)
+{
+    sort_seconds = seconds;
+    sort_pending = false;
+}
+
+bool Tuner::record(double seconds, std::size_t particles, double area)
+{
+    const double density = area > 0. ? particles/area : 0.;
+    if (phase == Phase::settled)
+    {
+        const auto drifted = [this](double value, double reference)
+        {
+            return std::abs(value - reference) > drift*reference;
+        };
+        if (drifted(particles, reference_particles)
+            || drifted(density, reference_density))
+            start(best);
+        return false;
+    }
+
+    // The first step with new parameters rebins or reorders, which isn't
+    // what is being timed
+    if (taking_effect)
+    {
+        taking_effect = false;
+        return false;
+    }
+    times.push_back(seconds);
+
+    if (phase == Phase::sort_interval)
+    {
+        if (times.size() < 4*trial_steps)
+            return false;
+
+        // Least squares slope of the step time against the steps since the
+        // reordering
+        const double count = times.size();
+        const double mean_step = 0.5*(count-1.);
+        double mean_time = 0.;
+        for (double time : times)
+            mean_time += time/count;
+        double covariance = 0.;
+        double variance = 0.;
+        for (std::size_t k=0; k<times.size(); k++)
+        {
+            covariance += (k-mean_step)*(times[k]-mean_time);
+            variance += (k-mean_step)*(k-mean_step);
+        }
+        const double growth = covariance/variance;
+
+        // Without growth the order doesn't decay, so it is never reordered
+        best.sort_interval = 0;
+        if (growth > 0.)
+            best.sort_interval = (unsigned int)std::min(1e6,
+                std::max((double)trial_steps,
+                         std::sqrt(2.*sort_seconds/growth)));
+        current = best;
+        phase = Phase::settled;
+        reference_particles = particles;
+        reference_density = density;
+        settled_rounds++;
+        return true;
+    }
+
+    // Scored by the mean rather than a robust statistic, since the rare slow
+    // steps that rebin the grid are the cost that a larger skin trades for
+    if (times.size() < trial_steps)
+        return false;
+    double mean = 0.;
+    for (double time : times)
+        mean += time/times.size();
+    if (mean < best_time)
+    {
+        best_time = mean;
+        best = current;
+    }
+
+    candidate++;
+    if (candidate < candidates())
+        try_candidate();
+    else
+        next_phase();
+    return false;
+}
+
+std::size_t Tuner::candidates() const
+{
+    switch (phase)
+    {
+        case Phase::cell_factor:
+            return sizeof(cell_factors)/sizeof(cell_factors[0]);
+        case Phase::skin:
+            return sizeof(skins)/sizeof(skins[0]);
+        case Phase::chunk_size:
+            return sizeof(chunk_sizes)/sizeof(chunk_sizes[0]);
+        default:
+            return 0;
+    }
+}
+
+// The best parameters so far, with the one being tuned at the candidate
+void Tuner::try_candidate()
+{
+    current = best;
+    if (phase == Phase::cell_factor)
+        current.cell_factor = cell_factors[candidate];
+    else if (phase == Phase::skin)
+        current.skin = skins[candidate];
+    else if (phase == Phase::chunk_size)
+        current.chunk_size = chunk_sizes[candidate];
+    times.clear();
+    taking_effect = true;
+}
+
+void Tuner::next_phase()
+{
+    candidate = 0;
+    best_time = DBL_MAX;
+    if (phase == Phase::cell_factor)
+        phase = Phase::skin;
+    else if (phase == Phase::skin)
+        phase = Phase::chunk_size;
+    else
+    {
+        // Reorder once, and then watch the order decay without reordering
+        phase = Phase::sort_interval;
+        current = best;
+        current.sort_interval = 0;
+        times.clear();
+        taking_effect = true;
+        sort_pending = true;
+        return;
+    }
+    try_candidate();
+}
@@ -0,0 +1,65 @@
+// File: isolated_cluster.cpp
+// Author: Liam Clink <clink.6@osu.edu>
+//
+// A small drop of particles placed between the corners and center of the
+// root node, where none of the fixed samples see it. The quadtree has to
+// refine onto the drop anyway and reproduce its density. Run with
+// make verify, which exits with an error if the drop is lost.
+
+#include "../../include/quadtree.h"
+#include "../../include/kernel.h"
+#include <cmath>
+#include <iostream>
+
+int main()
+{
+    // 40 particles, 8 by 5 at a spacing of a quarter of their range
+    const double range = 0.02;
+    const double spacing = 0.25*range;
+    const double center_x = 0.3;
+    const double center_y = 0.7;
+    std::vector<SPHParticle> particles;
+    for (int i=0; i<8; i++)
+        for (int j=0; j<5; j++)
+        {
+            SPHParticle particle;
+            particle.position = {center_x + (i-3.5)*spacing,
+                                 center_y + (j-2.)*spacing};
+            particle.velocity = {0., 0.};
+            particle.mass = 1.;
+            particle.range = range;
+            particle.pressure = 0.;
+            particles.push_back(particle);
+        }
+
+    Grid grid;
+    grid.build(particles, range);
+    Quadtree quadtree;
+    quadtree.build(particles, grid, 0., 0., 1., 1.);
+
+    // Direct kernel sum at the center of the drop
+    double expected = 0.;
+    for (const SPHParticle& particle : particles)
+    {
+        const double distance = std::hypot(particle.position(0) - center_x,
+                                           particle.position(1) - center_y);
+        if (distance < range)
+            expected += particle.mass*cubic_sph_kernel_2d(distance/range)
+                        / (range*range);
+    }
+    const double sampled = quadtree.sample(center_x, center_y);
+    const double error = std::abs(sampled - expected)/expected;
+
+    std::cout << "nodes " << quadtree.node_count()
+              << " leaves " << quadtree.leaf_count() << '\n'
+              << "density at the drop " << sampled
+              << ", kernel sum " << expected
+              << ", relative error " << error << std::endl;
+
+    if (quadtree.leaf_count() <= 1 || error > 2.*quadtree.tolerance)
+    {
+        std::cerr << "isolated cluster was not resolved" << std::endl;
+        return 1;
+    }
+    return 0;
+}